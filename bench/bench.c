@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "motion.h"
+#include "pi.h"
+
+#include "bench.h"
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+double median(double *samples, int count)
+{
+  qsort(samples, count, sizeof(double), compare_double);
+  return samples[count / 2];
+}
+
+void report(const char *name, double *samples, int count, const char *unit)
+{
+  // how far from the median a sample is, as a factor
+  static const double edges[] = { 0.5, 0.9, 1.1, 1.5, 2, 4, 10 };
+  static const char *labels[] = { "   <0.5x", "0.5-0.9x", "0.9-1.1x", "1.1-1.5x", "  1.5-2x", "    2-4x", "   4-10x", "    >10x" };
+  const int BUCKETS = sizeof(labels) / sizeof(*labels);
+
+  qsort(samples, count, sizeof(double), compare_double);
+  double middle = samples[count / 2];
+  printf(
+    "  %-22s %10.2f %s median, %10.2f p99, %10.2f max\n",
+    name, middle, unit, samples[(int) (count * 0.99)], samples[count - 1]
+  );
+
+  int histogram[BUCKETS];
+  for (int i = 0; i < BUCKETS; i++) histogram[i] = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && samples[i] >= edges[bucket] * middle) bucket++;
+    histogram[bucket]++;
+  }
+  for (int i = 0; i < BUCKETS; i++)
+  {
+    if (!histogram[i]) continue;
+    double share = (double) histogram[i] / count;
+    // at least one mark so rare outliers show up
+    int width = 1 + (int) (share * 40);
+    printf("    %s %7.3f%% %.*s\n", labels[i], share * 100, width, "########################################");
+  }
+}
+
+struct eggbot_config bench_config()
+{
+  struct eggbot_config config = {
+    .pwm_config = {
+      .length_pow2 = 64,
+      .factor = BASE_PWM_FACTOR,
+      .lock_factor = LOCK_PWM_FACTOR,
+    },
+    .egg_config = { STEPPER_EGG_PIN1, STEPPER_EGG_PIN2, STEPPER_EGG_PIN3, STEPPER_EGG_PIN4 },
+    .pen_config = { STEPPER_PEN_PIN1, STEPPER_PEN_PIN2, STEPPER_PEN_PIN3, STEPPER_PEN_PIN4 },
+    .servo_config = {
+      .out = SERVO_PIN,
+      .low = SERVO_LOW, .high = SERVO_HIGH,
+      .pwm_low = SERVO_PWM_LOW, .pwm_high = SERVO_PWM_HIGH,
+      .pwm_length = SERVO_PWM_LENGTH,
+    },
+  };
+  config.cycles_per_s = config.pwm_config.length_pow2 * 1000000.0 / US_PER_PWM;
+  pwm_config_init(&config.pwm_config);
+  return config;
+}
+bool bench_failed = false;
+
+bool expect(bool ok)
+{
+  if (!ok) bench_failed = true;
+  return ok;
+}
+
+int main()
+{
+  // everything that writes gpios writes here
+  gpio_port = memory_register_page();
+
+  bench_frame_math();
+  bench_step();
+  bench_words();
+  bench_prepare();
+  bench_edges();
+  bench_machines();
+  bench_queue();
+  bench_queue_latency();
+  bench_queue_time();
+  bench_unit();
+  bench_parser();
+  bench_optimize();
+  bench_coalesce();
+  bench_planner();
+  bench_waveform();
+  bench_overlap();
+  if (bench_failed) fprintf(stderr, "some checks failed\n");
+  return bench_failed ? 1 : 0;
+}
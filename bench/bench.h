@@ -0,0 +1,55 @@
+#ifndef RASPBERRYEGG_BENCH_H
+#define RASPBERRYEGG_BENCH_H
+
+#include <stdbool.h>
+
+#include "motion.h"
+
+// sorts `samples`
+double median(double *samples, int count);
+
+// sorts `samples`; prints median, p99 and worst, and a histogram of how far samples stray from the median
+void report(const char *name, double *samples, int count, const char *unit);
+
+// set by expect() on any failed check; makes the bench exit non-zero
+extern bool bench_failed;
+
+// returns `ok`, for printing; a failed check fails the bench
+bool expect(bool ok);
+
+// the config.h pin map at US_PER_PWM, timed as if by a fixed 64 cycles per pwm frame
+struct eggbot_config bench_config();
+
+void bench_frame_math();
+
+void bench_step();
+
+void bench_words();
+
+void bench_prepare();
+
+void bench_edges();
+
+void bench_queue();
+
+void bench_queue_latency();
+
+void bench_queue_time();
+
+void bench_machines();
+
+void bench_unit();
+
+void bench_parser();
+
+void bench_optimize();
+
+void bench_coalesce();
+
+void bench_planner();
+
+void bench_waveform();
+
+void bench_overlap();
+
+#endif
@@ -0,0 +1,105 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "coalesce.h"
+#include "config.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define COALESCE_CURVE_MOVES 100000
+#define COALESCE_QUEUE_SLOTS 16
+
+struct sm
+{
+  int dt_ms, dpen, degg;
+};
+
+// a dense curve as the svg exporter writes it: a wavy line round the egg in 1-3 step moves
+// at a steady 500 steps/s, rounded to whole steps and ms
+static int write_curve(struct sm *moves)
+{
+  int count = 0, egg = 0, pen = 0;
+  for (int i = 1; count < COALESCE_CURVE_MOVES; i++)
+  {
+    double a = i * 0.0005;
+    int to_egg = (int) lround(i * 1.5), to_pen = (int) lround(300 * sin(a * 7));
+    int degg = to_egg - egg, dpen = to_pen - pen;
+    if (degg == 0 && dpen == 0) continue;
+    int dt_ms = (int) lround(hypot(degg, dpen) * 2);
+    moves[count++] = (struct sm) { dt_ms > 0 ? dt_ms : 1, dpen, degg };
+    egg = to_egg;
+    pen = to_pen;
+  }
+  return count;
+}
+
+// furthest the merged moves get from the originals, checked at every ms
+static double max_error(const struct sm *moves, int count, const struct sm *merged, int merged_count)
+{
+  double worst = 0;
+  int i = 0, i_ms = 0; // the original move, and how far into it
+  double pen = 0, egg = 0; // where the original move started
+  double merged_pen = 0, merged_egg = 0;
+  for (int m = 0; m < merged_count; m++)
+  {
+    for (int t = 0; t < merged[m].dt_ms; t++)
+    {
+      double f = (double) t / merged[m].dt_ms;
+      double g = (double) i_ms / moves[i].dt_ms;
+      double error = hypot(
+        merged_pen + merged[m].dpen * f - (pen + moves[i].dpen * g),
+        merged_egg + merged[m].degg * f - (egg + moves[i].degg * g)
+      );
+      if (error > worst) worst = error;
+      if (++i_ms == moves[i].dt_ms && i + 1 < count)
+      {
+        pen += moves[i].dpen;
+        egg += moves[i].degg;
+        i++;
+        i_ms = 0;
+      }
+    }
+    merged_pen += merged[m].dpen;
+    merged_egg += merged[m].degg;
+  }
+  return worst;
+}
+
+void bench_coalesce()
+{
+  struct sm *moves = malloc(sizeof(struct sm) * COALESCE_CURVE_MOVES);
+  struct sm *merged = malloc(sizeof(struct sm) * COALESCE_CURVE_MOVES);
+  int count = write_curve(moves);
+
+  struct coalescer coalescer;
+  coalescer_clear(&coalescer);
+  int merged_count = 0;
+  long total_ms = 0;
+  double start = secs();
+  for (int i = 0; i < count; i++)
+  {
+    total_ms += moves[i].dt_ms;
+    if (coalescer_push(&coalescer, moves[i].dt_ms, moves[i].dpen, moves[i].degg)) continue;
+    merged[merged_count++] = (struct sm) { coalescer.dt_ms, coalescer.dpen, coalescer.degg };
+    coalescer_clear(&coalescer);
+    coalescer_push(&coalescer, moves[i].dt_ms, moves[i].dpen, moves[i].degg);
+  }
+  merged[merged_count++] = (struct sm) { coalescer.dt_ms, coalescer.dpen, coalescer.degg };
+  double elapsed = secs() - start;
+
+  printf("move coalescing, %i moves over %.1f s of dense curve:\n", count, total_ms / 1000.0);
+  printf(
+    "  %i moves after merging (%.1fx fewer), %.0f ns per move\n",
+    merged_count, (double) count / merged_count, elapsed / count * 1e9
+  );
+  printf(
+    "  %i queue slots hold %.0f ms of motion instead of %.0f ms\n",
+    COALESCE_QUEUE_SLOTS, (double) total_ms / merged_count * COALESCE_QUEUE_SLOTS, (double) total_ms / count * COALESCE_QUEUE_SLOTS
+  );
+  double error = max_error(moves, count, merged, merged_count);
+  printf("  worst error %.3f steps, bound %.3f: %s\n", error, COALESCE_ERROR, expect(error <= COALESCE_ERROR + 1e-9) ? "ok" : "OVER");
+  free(moves);
+  free(merged);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "motion.h"
+#include "pi.h"
+#include "step.h"
+#include "trace.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define EDGE_FRAMES 20000
+
+// with the pen coming down, so the servo edges move through the frame too
+static void edge_move(struct eggbot_config *config, int frames, coordinate *fromp, coordinate *top, float *dtp)
+{
+  coordinate from = {{ 0 }};
+  from.egg_speed = 20;
+  from.pen_speed = -3;
+  from.servo = 1;
+  *fromp = from;
+  *dtp = frames * config->pwm_config.length_pow2 / config->cycles_per_s;
+  *top = coord_advance(from, 20 * *dtp, -3 * *dtp, 0);
+}
+
+// replaying frame_edges() must give the levels frame_bits() does, at every cycle, for whole and cut-off frames
+static void check_edges(struct eggbot_config *config)
+{
+  int length = config->pwm_config.length_pow2;
+  uint32_t pin_mask = config_pin_mask(config);
+  coordinate from, to;
+  float dt;
+  edge_move(config, EDGE_FRAMES, &from, &to, &dt);
+
+  struct motion motion;
+  motion_init(&motion, config, from, to, dt, EDGE_FRAMES * length, false);
+  for (int n = 0; n < EDGE_FRAMES; n++)
+  {
+    struct frame frame;
+    motion_frame(&motion, config, n * length, n * US_PER_PWM / 1000000.0, &frame);
+    int frame_length = n % 7 == 6 ? rand() % length + 1 : length;
+
+    struct edge edges[FRAME_MAX_EDGES];
+    int count = frame_edges(&frame, frame_length, pin_mask, edges);
+    uint32_t levels = 0;
+    for (int k = 0, e = 0; k < frame_length; k++)
+    {
+      for (; e < count && edges[e].k == k; e++)
+      {
+        levels = (levels | edges[e].set) & ~edges[e].clr;
+      }
+      if (levels != frame_bits(&frame, k))
+      {
+        fprintf(stderr, "edges: frame %i, cycle %i: %08x vs %08x\n", n, k, levels, frame_bits(&frame, k));
+        abort();
+      }
+    }
+  }
+}
+
+// gpio writes per frame and wall time per frame, through step() on the memory page
+static void bench_engine(const char *name, struct eggbot_config *config)
+{
+  coordinate from, to;
+  float dt;
+  edge_move(config, EDGE_FRAMES, &from, &to, &dt);
+
+  gpio_trace->writes = 0;
+  gpio_trace->count = 0;
+  double start = secs();
+  step(config, NULL, from, to, dt, false);
+  double elapsed = secs() - start;
+  printf(
+    "  %-22s %6i cycles/frame, %8.2f writes/frame, %6.2f us/frame\n",
+    name, config->pwm_config.length_pow2, (double) gpio_trace->writes / EDGE_FRAMES, elapsed * 1e6 / EDGE_FRAMES
+  );
+}
+
+void bench_edges()
+{
+  struct eggbot_config loop = bench_config();
+  struct eggbot_config edge = bench_config();
+  edge.pwm_config.engine = PWM_ENGINE_EDGE;
+  edge.pwm_config.length_pow2 = EDGE_PWM_LENGTH_MAX;
+  edge.cycles_per_s = EDGE_PWM_LENGTH_MAX * 1000000.0 / US_PER_PWM;
+  pwm_config_init(&edge.pwm_config);
+
+  check_edges(&loop);
+  check_edges(&edge);
+
+  printf("pwm engines, %i frames at %.1f us/frame:\n", EDGE_FRAMES, US_PER_PWM);
+  // counts writes; the entries themselves are dropped once it fills
+  trace_start(1024);
+  bench_engine("loop", &loop);
+  bench_engine("edge", &edge);
+  gpio_trace = NULL;
+}
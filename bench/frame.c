@@ -0,0 +1,150 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "motion.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define FRAMES (1024 * 256)
+#define RUNS 15
+
+// the double-precision sinf/cosf/powf frame computation motion_frame() replaced, kept as a baseline
+struct float_motion
+{
+  coordinate from, to;
+  int cycles;
+  double egg_accel_unit, egg_v0_unit;
+  double pen_accel_unit, pen_v0_unit;
+};
+
+static struct float_motion float_motion_init(coordinate from, coordinate to, float dt, int cycles)
+{
+  float distance_egg = unit_diff_f(from.egg, to.egg);
+  float distance_pen = unit_diff_f(from.pen, to.pen);
+  return (struct float_motion) {
+    .from = from, .to = to, .cycles = cycles,
+    .egg_accel_unit = move_accel(distance_egg, dt, from.egg_speed) * dt * dt,
+    .egg_v0_unit = from.egg_speed * dt,
+    .pen_accel_unit = move_accel(distance_pen, dt, from.pen_speed) * dt * dt,
+    .pen_v0_unit = from.pen_speed * dt,
+  };
+}
+
+static void float_frame(struct eggbot_config *config, const struct float_motion *motion, int i, double t_global, struct frame *frame)
+{
+  const float TWOPI = M_PI * 2.0;
+  coordinate from = motion->from, to = motion->to;
+
+  double t = (double) i / (double) motion->cycles;
+  double egg_angle = unit_substep(from.egg) + (motion->egg_accel_unit / 2.0) * t * t + motion->egg_v0_unit * t;
+  double pen_angle = unit_substep(from.pen) + (motion->pen_accel_unit / 2.0) * t * t + motion->pen_v0_unit * t;
+  float egg_angle_substep = TWOPI * (egg_angle - floor(egg_angle));
+  float pen_angle_substep = TWOPI * (pen_angle - floor(pen_angle));
+
+  float egg_sin = sinf(egg_angle_substep), egg_cos = cosf(egg_angle_substep);
+  float pen_sin = sinf(pen_angle_substep), pen_cos = cosf(pen_angle_substep);
+
+  const float exp = 1.0;
+
+  float egg_winding1 = copysignf(powf(fabsf(egg_sin), exp), egg_sin);
+  float egg_winding2 = copysignf(powf(fabsf(egg_cos), exp), egg_cos);
+  float pen_winding1 = copysignf(powf(fabsf(pen_sin), exp), pen_sin);
+  float pen_winding2 = copysignf(powf(fabsf(pen_cos), exp), pen_cos);
+
+  float servo_f = servo_factor(config->servo_config, blend(t, from.servo, to.servo));
+  float pwm_length = config->servo_config.pwm_length;
+  float servo_t = ((t_global / pwm_length) - floor(t_global / pwm_length)) * pwm_length;
+
+  const struct stepper_config *egg_config = &config->egg_config;
+  const struct stepper_config *pen_config = &config->pen_config;
+  float pwm_factor = config->pwm_config.factor;
+  int length_pow2 = config->pwm_config.length_pow2;
+
+  *frame = (struct frame) {
+    .pwm_limit_egg_winding1 = (int) (pwm_factor * fabsf(egg_winding1) * length_pow2),
+    .pwm_limit_egg_winding2 = (int) (pwm_factor * fabsf(egg_winding2) * length_pow2),
+    .pwm_limit_pen_winding1 = (int) (pwm_factor * fabsf(pen_winding1) * length_pow2),
+    .pwm_limit_pen_winding2 = (int) (pwm_factor * fabsf(pen_winding2) * length_pow2),
+    .bits_egg_winding1 = ((egg_winding1 > 0) << egg_config->out1) | ((egg_winding1 < 0) << egg_config->out2),
+    .bits_egg_winding2 = ((egg_winding2 > 0) << egg_config->out3) | ((egg_winding2 < 0) << egg_config->out4),
+    .bits_pen_winding1 = ((pen_winding1 > 0) << pen_config->out1) | ((pen_winding1 < 0) << pen_config->out2),
+    .bits_pen_winding2 = ((pen_winding2 > 0) << pen_config->out3) | ((pen_winding2 < 0) << pen_config->out4),
+    .bit_servo = (1 << config->servo_config.out),
+    .servo_to_low = (int)((servo_f * pwm_length - servo_t) * config->cycles_per_s),
+    .servo_to_high = (int)((pwm_length - servo_t) * config->cycles_per_s),
+  };
+}
+
+// an accelerating move over FRAMES pwm frames
+static void bench_move(struct eggbot_config *config, coordinate *fromp, coordinate *top, float *dtp)
+{
+  coordinate from = {{ 0 }};
+  from.egg_speed = 20;
+  from.pen_speed = -3;
+  *fromp = from;
+  *dtp = FRAMES * config->pwm_config.length_pow2 / config->cycles_per_s;
+  *top = coord_advance(from, 150, -20, 0);
+}
+
+static volatile uint32_t sink;
+
+void bench_frame_math()
+{
+  struct eggbot_config config = bench_config();
+  coordinate from, to;
+  float dt;
+  bench_move(&config, &from, &to, &dt);
+  int length = config.pwm_config.length_pow2;
+  int cycles = FRAMES * length;
+
+  double float_ns[RUNS], table_ns[RUNS];
+  for (int run = 0; run < RUNS; run++)
+  {
+    struct frame frame;
+    double start = secs();
+    struct float_motion reference = float_motion_init(from, to, dt, cycles);
+    for (int n = 0; n < FRAMES; n++)
+    {
+      float_frame(&config, &reference, n * length, n * 0.00004, &frame);
+      sink = frame.pwm_limit_egg_winding1 ^ frame.pwm_limit_pen_winding2 ^ frame.servo_to_low;
+    }
+    float_ns[run] = (secs() - start) * 1e9 / FRAMES;
+
+    struct motion motion;
+    start = secs();
+    motion_init(&motion, &config, from, to, dt, cycles, false);
+    for (int n = 0; n < FRAMES; n++)
+    {
+      motion_frame(&motion, &config, n * length, n * 0.00004, &frame);
+      sink = frame.pwm_limit_egg_winding1 ^ frame.pwm_limit_pen_winding2 ^ frame.servo_to_low;
+    }
+    table_ns[run] = (secs() - start) * 1e9 / FRAMES;
+  }
+
+  // how far the table path strays from the float one, in pwm cycles
+  int max_error = 0;
+  struct motion motion;
+  struct float_motion float_motion = float_motion_init(from, to, dt, cycles);
+  motion_init(&motion, &config, from, to, dt, cycles, false);
+  for (int n = 0; n < FRAMES; n++)
+  {
+    struct frame reference, frame;
+    float_frame(&config, &float_motion, n * length, 0, &reference);
+    motion_frame(&motion, &config, n * length, 0, &frame);
+    int error = abs(reference.pwm_limit_egg_winding1 - frame.pwm_limit_egg_winding1);
+    error = error > abs(reference.pwm_limit_pen_winding2 - frame.pwm_limit_pen_winding2) ? error : abs(reference.pwm_limit_pen_winding2 - frame.pwm_limit_pen_winding2);
+    if (error > max_error) max_error = error;
+  }
+
+  double float_median = median(float_ns, RUNS), table_median = median(table_ns, RUNS);
+  printf("frame math, %i frames of %i cycles:\n", FRAMES, length);
+  printf("  float path   %8.2f ns/frame\n", float_median);
+  printf("  table path   %8.2f ns/frame (%.1fx)\n", table_median, float_median / table_median);
+  printf("  max duty difference %i/%i cycles\n", max_error, length);
+}
+
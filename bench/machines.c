@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "pi.h"
+#include "step.h"
+#include "trace.h"
+#include "util.h"
+
+#include "bench.h"
+
+// 160020.48 cycles: every run gets the same count, and it ends in the middle of a frame with pins on
+#define MACHINE_MOVE_S 0.1000128
+#define MACHINE_TRACE_CAPACITY (1024 * 1024)
+
+struct machine_run
+{
+  struct eggbot_config config;
+  coordinate from, to;
+  double elapsed;
+};
+
+static void *machine_run_task(void *data)
+{
+  struct machine_run *run = data;
+  double start = secs();
+  step(&run->config, NULL, run->from, run->to, MACHINE_MOVE_S, false);
+  run->elapsed = secs() - start;
+  return NULL;
+}
+
+// the writes that touched the machine's pins, masked to them, in order
+static struct trace_entry *machine_writes(uint32_t mask, size_t *count)
+{
+  size_t total = trace_finish();
+  struct trace_entry *writes = malloc(sizeof(struct trace_entry) * (total + 1));
+  *count = 0;
+  for (size_t i = 0; i < total; i++)
+  {
+    struct trace_entry entry = gpio_trace->entries[i];
+    entry.ns = 0;
+    entry.set &= mask;
+    entry.clr &= mask;
+    if (entry.set | entry.clr) writes[(*count)++] = entry;
+  }
+  return writes;
+}
+
+static void trace_clear()
+{
+  gpio_trace->count = 0;
+  gpio_trace->writes = 0;
+  gpio_trace->dropped = 0;
+  atomic_store(gpio_levels, 0);
+}
+
+// two machines on their own pins, stepping into the one simulated register page at the same time.
+// each must write exactly what it writes running alone, and the level register must end up with
+// both machines' pins as they left them
+void bench_machines()
+{
+  struct machine_run runs[2];
+  runs[0].config = bench_config();
+  runs[1].config = bench_config();
+  runs[1].config.egg_config = (struct stepper_config) { 5, 6, 12, 13 };
+  runs[1].config.pen_config = (struct stepper_config) { 16, 19, 20, 21 };
+  runs[1].config.servo_config.out = 7;
+  for (int m = 0; m < 2; m++)
+  {
+    // servo edges go by the wall clock, so they'd differ between runs
+    runs[m].config.dry_run = true;
+    coordinate rest = {{ 0 }};
+    rest.egg_speed = m ? -15 : 20;
+    rest.pen_speed = m ? 7 : -5;
+    runs[m].from = rest;
+    runs[m].to = coord_advance(rest, rest.egg_speed * MACHINE_MOVE_S, rest.pen_speed * MACHINE_MOVE_S, rest.servo);
+  }
+
+  trace_start(MACHINE_TRACE_CAPACITY);
+  struct trace_entry *alone[2];
+  size_t alone_count[2];
+  uint32_t levels = 0;
+  double alone_s = 0;
+  for (int m = 0; m < 2; m++)
+  {
+    trace_clear();
+    machine_run_task(&runs[m]);
+    alone_s += runs[m].elapsed;
+    alone[m] = machine_writes(config_pin_mask(&runs[m].config), &alone_count[m]);
+    levels |= atomic_load(gpio_levels);
+  }
+
+  trace_clear();
+  pthread_t threads[2];
+  double start = secs();
+  for (int m = 0; m < 2; m++)
+  {
+    pthread_create(&threads[m], NULL, machine_run_task, &runs[m]);
+  }
+  for (int m = 0; m < 2; m++)
+  {
+    pthread_join(threads[m], NULL);
+  }
+  double together_s = secs() - start;
+
+  bool same = gpio_trace->dropped == 0;
+  for (int m = 0; m < 2; m++)
+  {
+    size_t count;
+    struct trace_entry *together = machine_writes(config_pin_mask(&runs[m].config), &count);
+    same &= count == alone_count[m] && memcmp(together, alone[m], count * sizeof(struct trace_entry)) == 0;
+    free(together);
+    free(alone[m]);
+  }
+  bool levels_ok = atomic_load(gpio_levels) == levels;
+  free(gpio_trace->entries);
+  free(gpio_trace);
+  gpio_trace = NULL;
+
+  printf("two machines on one register page, %.0f ms moves:\n", MACHINE_MOVE_S * 1e3);
+  printf("  %.1f ms one after the other, %.1f ms at once\n", alone_s * 1e3, together_s * 1e3);
+  printf("  writes as when alone: %s; levels %08x: %s\n", expect(same) ? "yes" : "NO", levels, expect(levels_ok) ? "ok" : "WRONG");
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "eggcode.h"
+#include "optimize.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define OPTIMIZE_STROKES 20000
+
+// what the artwork looks like: short squiggles all over the egg, in no particular order, with
+// pen-up moves in between at 2000 steps/s
+static void write_artwork(const char *filename)
+{
+  FILE *file = fopen(filename, "w");
+  srand(2);
+  int egg = 0, pen = 0;
+  for (int i = 0; i < OPTIMIZE_STROKES; i++)
+  {
+    int to_egg = rand() % EGG_STEPS_PER_TURN, to_pen = rand() % 801 - 400;
+    int degg = to_egg - egg, dpen = to_pen - pen;
+    int steps = abs(degg) > abs(dpen) ? abs(degg) : abs(dpen);
+    fprintf(file, "SM,%i,%i,%i\n", steps / 2 + 1, dpen, degg);
+    egg = to_egg;
+    pen = to_pen;
+
+    fprintf(file, "SP,0,100\n");
+    for (int k = 0; k < 1 + rand() % 8; k++)
+    {
+      int move_egg = rand() % 41 - 20, move_pen = rand() % 41 - 20;
+      fprintf(file, "SM,%i,%i,%i\n", 20 + rand() % 40, move_pen, move_egg);
+      egg += move_egg;
+      pen += move_pen;
+    }
+    fprintf(file, "SP,1,100\n");
+  }
+  fprintf(file, "SM,%i,%i,%i\n", 1000, -pen, -egg);
+  fclose(file);
+}
+
+struct segment
+{
+  int egg0, pen0, egg1, pen1;
+};
+
+static int compare_segment(const void *a, const void *b)
+{
+  return memcmp(a, b, sizeof(struct segment));
+}
+
+// every pen-down move, the egg within one turn, each the same way round; sorted
+static struct segment *drawn_segments(struct eggcode_parser *parser, int *count)
+{
+  struct segment *segments = NULL;
+  int capacity = 0;
+  *count = 0;
+  struct eggcode_command command;
+  int egg = 0, pen = 0;
+  bool down = false;
+  while (eggcode_next(parser, &command))
+  {
+    if (command.kind == EGGCODE_SP) down = command.args[0] == 0;
+    if (command.kind != EGGCODE_SM) continue;
+
+    int turn = EGG_STEPS_PER_TURN;
+    struct segment segment = { (egg % turn + turn) % turn, pen, 0, pen + command.args[1] };
+    segment.egg1 = segment.egg0 + command.args[2];
+    egg += command.args[2];
+    pen += command.args[1];
+    if (!down) continue;
+
+    if (segment.egg1 < segment.egg0 || (segment.egg1 == segment.egg0 && segment.pen1 < segment.pen0))
+    {
+      // the same line drawn the other way: start from its other end, within the turn
+      int shift = (segment.egg1 % turn + turn) % turn - segment.egg1;
+      segment = (struct segment) { segment.egg1 + shift, segment.pen1, segment.egg0 + shift, segment.pen0 };
+    }
+    if (*count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 1024;
+      segments = realloc(segments, capacity * sizeof(struct segment));
+    }
+    segments[(*count)++] = segment;
+  }
+  qsort(segments, *count, sizeof(struct segment), compare_segment);
+  return segments;
+}
+
+void bench_optimize()
+{
+  char filename[] = "/tmp/raspberryegg-bench-XXXXXX";
+  int fd = mkstemp(filename);
+  close(fd);
+  write_artwork(filename);
+
+  struct eggcode_parser parser;
+  eggcode_open(&parser, filename);
+  int before_count;
+  struct segment *before = drawn_segments(&parser, &before_count);
+  eggcode_close(&parser);
+
+  eggcode_open(&parser, filename);
+  struct optimize_stats stats;
+  double start = secs();
+  bool optimized = eggcode_optimize(&parser, &stats);
+  double elapsed = secs() - start;
+  int after_count;
+  struct segment *after = drawn_segments(&parser, &after_count);
+  eggcode_close(&parser);
+  unlink(filename);
+
+  bool same = optimized && before_count == after_count
+    && memcmp(before, after, before_count * sizeof(struct segment)) == 0;
+  printf("travel optimizer, %i strokes, %i pen-down moves:\n", stats.strokes, before_count);
+  printf(
+    "  %.3f s to reorder; pen-up travel %.1f s -> %.1f s (%.1fx less), %i strokes backwards\n",
+    elapsed, stats.travel_before, stats.travel_after, stats.travel_before / stats.travel_after, stats.reversed
+  );
+  printf("  drawing unchanged: %s\n", expect(same) ? "yes" : "NO");
+  free(before);
+  free(after);
+}
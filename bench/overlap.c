@@ -0,0 +1,111 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "overlap.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define OVERLAP_STROKES 20000
+#define OVERLAP_CLEARANCE 0.5
+#define OVERLAP_PEN_S 0.1 // per SP, down to up
+
+struct overlap_check
+{
+  coordinate last;
+  bool first;
+  double out_s;
+  int moves;
+  bool clear, pace, chained;
+};
+
+static void check_moves(struct pen_overlap *overlap, struct overlap_check *check)
+{
+  struct overlap_move move;
+  while (overlap_pop(overlap, &move))
+  {
+    bool moving = move.from.egg.fixed != move.to.egg.fixed || move.from.pen.fixed != move.to.pen.fixed;
+    bool drawing = move.from.servo == 0 && move.to.servo == 0;
+    // the axes only move with the pen down or clear of the egg
+    check->clear &= !moving || drawing || fminf(move.from.servo, move.to.servo) >= OVERLAP_CLEARANCE - 1e-6;
+    // never faster than the SPs asked for
+    check->pace &= fabsf(move.to.servo - move.from.servo) <= move.dt / OVERLAP_PEN_S * (1 + 1e-3) + 1e-6;
+    check->chained &= check->first || (
+      move.from.egg.fixed == check->last.egg.fixed && move.from.pen.fixed == check->last.pen.fixed
+      && move.from.servo == check->last.servo
+    );
+    check->first = false;
+    check->last = move.to;
+    check->out_s += move.dt;
+    check->moves++;
+  }
+}
+
+// the queue_task() calls artwork makes: a few pen-up moves over to a stroke, the pen down, some short
+// drawing moves, the pen up again
+void bench_overlap()
+{
+  struct pen_overlap overlap;
+  overlap_init(&overlap, bench_config().servo_config, OVERLAP_CLEARANCE);
+  struct overlap_check check = { .first = true, .clear = true, .pace = true, .chained = true };
+  srand(4);
+  coordinate pos = {{ 0 }};
+  pos.servo = 1.0;
+  double in_s = 0;
+  int in_moves = 0;
+  double start = secs();
+  for (int i = 0; i < OVERLAP_STROKES; i++)
+  {
+    for (int k = 0; k < 1 + rand() % 4; k++)
+    {
+      float dt = 0.01 + rand() % 50 / 1000.0;
+      coordinate next = coord_advance(pos, (rand() % 201 - 100) / 64.0, (rand() % 41 - 20) / 90.0, pos.servo);
+      overlap_push(&overlap, pos, next, dt);
+      pos = next;
+      in_s += dt;
+      in_moves++;
+      check_moves(&overlap, &check);
+    }
+    for (int down = 1; down >= 0; down--)
+    {
+      coordinate next = coord_advance(pos, 0, 0, 1 - down);
+      overlap_push(&overlap, pos, next, OVERLAP_PEN_S);
+      pos = next;
+      in_s += OVERLAP_PEN_S;
+      in_moves++;
+      check_moves(&overlap, &check);
+      if (!down) break;
+      for (int k = 0; k < 1 + rand() % 8; k++)
+      {
+        float dt = 0.02 + rand() % 40 / 1000.0;
+        coordinate next = coord_advance(pos, (rand() % 41 - 20) / 64.0, (rand() % 41 - 20) / 90.0, 0);
+        overlap_push(&overlap, pos, next, dt);
+        pos = next;
+        in_s += dt;
+        in_moves++;
+        check_moves(&overlap, &check);
+      }
+    }
+  }
+  overlap_flush(&overlap);
+  check_moves(&overlap, &check);
+  double elapsed = secs() - start;
+
+  bool ends = check.last.egg.fixed == pos.egg.fixed && check.last.pen.fixed == pos.pen.fixed && check.last.servo == pos.servo;
+  bool saved = fabs(in_s - check.out_s - overlap_saved(&overlap)) < 1e-3;
+  printf("pen change overlap, %i strokes, clearance %.2f:\n", OVERLAP_STROKES, OVERLAP_CLEARANCE);
+  printf(
+    "  %.1f s -> %.1f s, %.1f s of %.1f s pen changes saved; %.0f ns per move\n",
+    in_s, check.out_s, overlap_saved(&overlap), overlap.change_s, elapsed / in_moves * 1e9
+  );
+  printf(
+    "  axes only move clear of the egg: %s; servo within the SP pace: %s\n",
+    expect(check.clear) ? "ok" : "FAIL", expect(check.pace) ? "ok" : "FAIL"
+  );
+  printf(
+    "  moves chained and end where they should: %s; saving adds up: %s\n",
+    expect(check.chained && ends) ? "ok" : "FAIL", expect(saved) ? "ok" : "FAIL"
+  );
+}
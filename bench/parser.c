@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "eggcode.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define PARSER_LINES (1024 * 1024 * 2)
+#define PARSER_RUNS 5
+
+// a big eggcode file like the svg exporter writes: mostly short moves, the odd pen change
+static void write_eggcode(const char *filename, long *size)
+{
+  FILE *file = fopen(filename, "w");
+  srand(1);
+  for (int i = 0; i < PARSER_LINES; i++)
+  {
+    if (i % 100 == 0)
+    {
+      fprintf(file, "SP,%i,150\r\n", (i / 100) % 2);
+    }
+    else
+    {
+      fprintf(file, "SM,%i,%i,%i\r\n", 5 + rand() % 40, rand() % 21 - 10, rand() % 61 - 30);
+    }
+  }
+  *size = ftell(file);
+  fclose(file);
+}
+
+// the getline/strncmp/sscanf loop eggcode_next() replaced, kept as a baseline
+static long getline_checksum(const char *filename)
+{
+  long checksum = 0;
+  FILE *cmd_file = fopen(filename, "r");
+  char *line_ptr = NULL;
+  size_t line_len0 = 0;
+  while (getline(&line_ptr, &line_len0, cmd_file) != -1)
+  {
+    int a, b, c;
+    if (strncmp(line_ptr, "SP,", 3) == 0 && sscanf(line_ptr, "SP,%i,%i", &a, &b) == 2)
+    {
+      checksum += a + b;
+    }
+    else if (strncmp(line_ptr, "SM,", 3) == 0 && sscanf(line_ptr, "SM,%i,%i,%i", &a, &b, &c) == 3)
+    {
+      checksum += a + b + c;
+    }
+  }
+  free(line_ptr);
+  fclose(cmd_file);
+  return checksum;
+}
+
+static long eggcode_checksum(const char *filename)
+{
+  long checksum = 0;
+  struct eggcode_parser parser;
+  struct eggcode_command command;
+  eggcode_open(&parser, filename);
+  while (eggcode_next(&parser, &command))
+  {
+    if (command.kind == EGGCODE_SP) checksum += command.args[0] + command.args[1];
+    if (command.kind == EGGCODE_SM) checksum += command.args[0] + command.args[1] + command.args[2];
+  }
+  eggcode_close(&parser);
+  return checksum;
+}
+
+struct pipe_feed
+{
+  const char *filename;
+  int fd;
+};
+
+static void *pipe_feed_task(void *data)
+{
+  struct pipe_feed *feed = data;
+  int in = open(feed->filename, O_RDONLY);
+  char buffer[16384];
+  ssize_t got;
+  while ((got = read(in, buffer, sizeof(buffer))) > 0)
+  {
+    for (ssize_t done = 0; done < got; )
+    {
+      ssize_t put = write(feed->fd, buffer + done, got - done);
+      if (put <= 0) abort();
+      done += put;
+    }
+  }
+  close(in);
+  close(feed->fd);
+  return NULL;
+}
+
+// the file streamed in through a pipe, as from a generator
+static long stream_checksum(const char *filename)
+{
+  int fds[2];
+  if (pipe(fds) != 0) abort();
+  struct pipe_feed feed = { filename, fds[1] };
+  pthread_t thread;
+  pthread_create(&thread, NULL, pipe_feed_task, &feed);
+  char path[32];
+  snprintf(path, sizeof(path), "/dev/fd/%i", fds[0]);
+  long checksum = eggcode_checksum(path);
+  pthread_join(thread, NULL);
+  close(fds[0]);
+  return checksum;
+}
+
+void bench_parser()
+{
+  char filename[] = "/tmp/raspberryegg-bench-XXXXXX";
+  int fd = mkstemp(filename);
+  close(fd);
+  long size;
+  write_eggcode(filename, &size);
+
+  // the same file as binary eggcode
+  char binary_filename[] = "/tmp/raspberryegg-bench-XXXXXX";
+  fd = mkstemp(binary_filename);
+  close(fd);
+  struct eggcode_parser parser;
+  struct eggcode_binary_header header, probed;
+  eggcode_open(&parser, filename);
+  eggcode_write_binary(&parser, binary_filename, &header);
+  eggcode_close(&parser);
+  bool header_ok = eggcode_probe_binary(binary_filename, &probed) && memcmp(&header, &probed, sizeof(header)) == 0
+    && header.command_count == PARSER_LINES;
+
+  double getline_s[PARSER_RUNS], eggcode_s[PARSER_RUNS], binary_s[PARSER_RUNS], stream_s[PARSER_RUNS];
+  long getline_sum = 0, eggcode_sum = 0, binary_sum = 0, stream_sum = 0;
+  for (int run = 0; run < PARSER_RUNS; run++)
+  {
+    double start = secs();
+    getline_sum = getline_checksum(filename);
+    getline_s[run] = secs() - start;
+
+    start = secs();
+    eggcode_sum = eggcode_checksum(filename);
+    eggcode_s[run] = secs() - start;
+
+    start = secs();
+    binary_sum = eggcode_checksum(binary_filename);
+    binary_s[run] = secs() - start;
+
+    start = secs();
+    stream_sum = stream_checksum(filename);
+    stream_s[run] = secs() - start;
+  }
+  unlink(filename);
+  unlink(binary_filename);
+
+  if (getline_sum != eggcode_sum || binary_sum != eggcode_sum || stream_sum != eggcode_sum)
+  {
+    fprintf(stderr, "parser: checksum mismatch, %li vs %li vs %li vs %li\n", getline_sum, eggcode_sum, binary_sum, stream_sum);
+    abort();
+  }
+  double getline_median = median(getline_s, PARSER_RUNS), eggcode_median = median(eggcode_s, PARSER_RUNS);
+  double binary_median = median(binary_s, PARSER_RUNS), stream_median = median(stream_s, PARSER_RUNS);
+  printf("eggcode parser, %i lines, %.1f MB:\n", PARSER_LINES, size / 1e6);
+  printf("  getline/sscanf %8.1f MB/s, %6.2f Mlines/s\n", size / 1e6 / getline_median, PARSER_LINES / 1e6 / getline_median);
+  printf("  mmap/scan      %8.1f MB/s, %6.2f Mlines/s (%.1fx)\n", size / 1e6 / eggcode_median, PARSER_LINES / 1e6 / eggcode_median, getline_median / eggcode_median);
+  printf("  binary         %8.1f MB/s, %6.2f Mlines/s (%.1fx)\n", size / 1e6 / binary_median, PARSER_LINES / 1e6 / binary_median, getline_median / binary_median);
+  printf("  piped          %8.1f MB/s, %6.2f Mlines/s (%.1fx), %i KB buffer\n", size / 1e6 / stream_median, PARSER_LINES / 1e6 / stream_median, getline_median / stream_median, EGGCODE_STREAM_BUFFER / 1024);
+  printf("  binary header: %s\n", expect(header_ok) ? "ok" : "WRONG");
+}
@@ -0,0 +1,129 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "planner.h"
+#include "simulate.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define PLANNER_STROKES 5000
+#define PLANNER_SPEED 2.0 // as with -s 2
+
+struct planner_run
+{
+  struct planner planner;
+  struct simulation sim;
+  coordinate pos;
+  long egg_steps, pen_steps, segments; // all that was planned
+};
+
+// what main.c's planner_advance() does, into the simulator instead of the queue
+static void run_planned(struct planner_run *run)
+{
+  struct planner_move moves[3];
+  int count = planner_pop(&run->planner, moves);
+  for (int i = 0; i < count; i++)
+  {
+    run->pos.egg_speed = moves[i].egg_speed;
+    run->pos.pen_speed = moves[i].pen_speed;
+    coordinate next = coord_advance(run->pos, moves[i].egg, moves[i].pen, run->pos.servo);
+    simulate_task(&run->sim, run->pos, next, moves[i].dt);
+    next.egg_speed = end_speed(unit_diff_f(run->pos.egg, next.egg), moves[i].dt, run->pos.egg_speed);
+    next.pen_speed = end_speed(unit_diff_f(run->pos.pen, next.pen), moves[i].dt, run->pos.pen_speed);
+    run->pos = next;
+  }
+}
+
+static void plan(struct planner_run *run, int dt_ms, int dpen, int degg)
+{
+  if (planner_full(&run->planner)) run_planned(run);
+  run->egg_steps += degg;
+  run->pen_steps += dpen;
+  run->segments++;
+  planner_push(
+    &run->planner, degg / (double) EGG_STEPS_PER_UNIT, dpen / (double) PEN_STEPS_PER_UNIT,
+    dt_ms / PLANNER_SPEED / 1000.0
+  );
+}
+
+// as at an SP: the planner comes to a stop, then the servo moves with the axes standing still
+static void pen(struct planner_run *run, float servo)
+{
+  while (!planner_empty(&run->planner)) run_planned(run);
+  run->pos.egg_speed = 0;
+  run->pos.pen_speed = 0;
+  coordinate next = coord_advance(run->pos, 0, 0, servo);
+  simulate_task(&run->sim, run->pos, next, 0.1);
+  run->pos = next;
+}
+
+// planned moves go through the simulator, which flags every one over the planner's own limits.
+// the job is plain strokes: pen-up travel, then short drawing moves, at twice the eggcode's speed,
+// so the planner keeps cutting moves short of their nominal speed and stops at every SP
+void bench_planner()
+{
+  struct planner_config limits = {
+    .egg_accel = PLANNER_EGG_ACCEL,
+    .pen_accel = PLANNER_PEN_ACCEL,
+    .egg_jump = PLANNER_EGG_JUMP,
+    .pen_jump = PLANNER_PEN_JUMP,
+    .egg_max_speed = PLANNER_EGG_MAX_SPEED,
+    .pen_max_speed = PLANNER_PEN_MAX_SPEED,
+  };
+  struct eggbot_config config = bench_config();
+  config.dry_run = true;
+
+  struct planner_run *run = malloc(sizeof(struct planner_run));
+  planner_init(&run->planner, limits);
+  simulate_init(&run->sim, config, limits, NULL);
+  simulate_file_start(&run->sim, "planner bench");
+  run->pos = (coordinate) {{ 0 }};
+  run->pos.servo = 1.0;
+  run->egg_steps = run->pen_steps = run->segments = 0;
+
+  srand(5);
+  int pen_steps = 0;
+  double start = secs();
+  for (int i = 0; i < PLANNER_STROKES; i++)
+  {
+    run->sim.line = i;
+    int to_pen = rand() % 601 - 300, degg = rand() % 801 - 400;
+    int dpen = to_pen - pen_steps, steps = abs(degg) > abs(dpen) ? abs(degg) : abs(dpen);
+    plan(run, steps / 2 + 1, dpen, degg);
+    pen_steps = to_pen;
+    pen(run, 0.0);
+    for (int k = 0; k < 1 + rand() % 12; k++)
+    {
+      int move_pen = rand() % 21 - 10, move_egg = rand() % 31 - 15;
+      if (move_pen == 0 && move_egg == 0) continue;
+      plan(run, 5 + rand() % 40, move_pen, move_egg);
+      pen_steps += move_pen;
+    }
+    pen(run, 1.0);
+  }
+  double elapsed = secs() - start;
+
+  struct simulation_peaks *peaks = &run->sim.file;
+  printf("planned moves through the simulator, %i strokes at %gx:\n", PLANNER_STROKES, PLANNER_SPEED);
+  printf(
+    "  %llu moves over %.1f s in %.3f s; egg up to %.0f units/s^2, pen up to %.0f units/s^2\n",
+    (unsigned long long) peaks->moves, peaks->time, elapsed, peaks->egg_accel, peaks->pen_accel
+  );
+  printf(
+    "  within the acceleration limits: %s; within the speed limits: %s; junctions within the jump limits: %s\n",
+    expect(peaks->over_accel == 0) ? "ok" : "FAIL", expect(peaks->over_speed == 0) ? "ok" : "FAIL",
+    expect(peaks->over_jump == 0) ? "ok" : "FAIL"
+  );
+  // egg steps are exact in units, pen steps round to 2^-32 once per segment, as unplanned moves do per move
+  bool egg_exact = run->pos.egg.fixed == run->egg_steps * (UNIT_ONE / EGG_STEPS_PER_UNIT);
+  double pen_error = fabs(unitf(run->pos.pen) - (double) run->pen_steps / PEN_STEPS_PER_UNIT);
+  printf(
+    "  ends where the eggcode does: egg %s, pen off by %.3g units in %li segments: %s\n",
+    egg_exact ? "exactly" : "NOT exactly", pen_error, run->segments,
+    expect(egg_exact && pen_error <= run->segments * 0x1p-33) ? "ok" : "FAIL"
+  );
+  free(run);
+}
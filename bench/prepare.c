@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "motion.h"
+#include "prepare.h"
+#include "step.h"
+#include "util.h"
+#include "words.h"
+
+#include "bench.h"
+
+#define PREPARE_MOVES 200
+#define PREPARE_SAMPLES 20000
+
+// a run of moves at a steady speed, each a few frames and a bit, so moves end partway into a frame
+static void write_moves(const struct eggbot_config *config, coordinate *points, float *dts)
+{
+  points[0] = (coordinate) {{ 0 }};
+  points[0].egg_speed = 20;
+  points[0].pen_speed = -5;
+  points[0].servo = 1;
+  for (int i = 0; i < PREPARE_MOVES; i++)
+  {
+    dts[i] = (4 + i % 7) * config->pwm_config.length_pow2 / config->cycles_per_s + (i % 5) * 3e-6f;
+    coordinate next = coord_advance(points[i], points[i].egg_speed * dts[i], points[i].pen_speed * dts[i], i % 40 < 20 ? 0 : 1);
+    next.egg_speed = points[i].egg_speed;
+    next.pen_speed = points[i].pen_speed;
+    points[i + 1] = next;
+  }
+}
+
+// the words step() would write for the moves, with the servo on the moves' own clock
+static size_t reference_words(struct eggbot_config *config, const coordinate *points, const float *dts, struct frame_word *words)
+{
+  uint32_t pin_mask = config_pin_mask(config);
+  int length = config->pwm_config.length_pow2;
+  double stream_s = 0;
+  size_t count = 0;
+  for (int m = 0; m < PREPARE_MOVES; m++)
+  {
+    int cycles = (int) (dts[m] * config->cycles_per_s);
+    struct motion motion;
+    motion_init(&motion, config, points[m], points[m + 1], dts[m], cycles, false);
+    uint32_t last_bits = 0;
+    size_t first = count;
+    for (int i = 0; i < cycles; )
+    {
+      struct frame frame;
+      motion_frame(&motion, config, i, stream_s, &frame);
+      int pwm_len = min(length, cycles - i);
+      stream_s += pwm_len / config->cycles_per_s;
+      frame_words_scalar(&frame, 1, pwm_len, &last_bits, words + count);
+      count += pwm_len;
+      i += pwm_len;
+    }
+    if (count > first) words[first].clr = pin_mask & ~words[first].set;
+  }
+  return count;
+}
+
+static void *prepare_moves_task(void *data)
+{
+  struct preparer *preparer = data;
+  preparer_task(preparer);
+  return NULL;
+}
+
+// the preparer's blocks, run through on a thread of their own as with -P: the same words step()
+// writes, and how long the worker takes per frame to write them out, against step() doing it all
+void bench_prepare()
+{
+  struct eggbot_config config = bench_config();
+  int length = config.pwm_config.length_pow2;
+  coordinate points[PREPARE_MOVES + 1];
+  float dts[PREPARE_MOVES];
+  write_moves(&config, points, dts);
+
+  size_t capacity = 0;
+  for (int m = 0; m < PREPARE_MOVES; m++) capacity += (size_t) (dts[m] * config.cycles_per_s) + 1;
+  struct frame_word *reference = malloc(sizeof(struct frame_word) * capacity);
+  struct frame_word *prepared = malloc(sizeof(struct frame_word) * capacity);
+  size_t reference_count = reference_words(&config, points, dts, reference);
+
+  struct task_ring_buffer *tasks = ringbuffer_init(PREPARE_MOVES + 1, INFINITY, INFINITY);
+  struct preparer *preparer = preparer_create(&config, tasks);
+  pthread_t thread;
+  pthread_create(&thread, NULL, prepare_moves_task, preparer);
+  for (int m = 0; m < PREPARE_MOVES; m++)
+  {
+    ringbuffer_queue(tasks, (struct task) { .from = points[m], .to = points[m + 1], .dt = dts[m] });
+  }
+  ringbuffer_queue(tasks, (struct task) { .quit = true });
+
+  size_t count = 0;
+  int moves = 0;
+  bool whole_frames = true, ends = true;
+  while (true)
+  {
+    while (!ringbuffer_peek(preparer->blocks)) { }
+    struct task task = ringbuffer_take(preparer->blocks);
+    if (task.quit) break;
+
+    const struct frame_block *block = task.block;
+    if (count + block->count <= capacity)
+    {
+      memcpy(prepared + count, block->words, sizeof(struct frame_word) * block->count);
+    }
+    count += block->count;
+    whole_frames &= block->last || block->count % length == 0;
+    if (block->last)
+    {
+      ends &= memcmp(&block->at, &points[moves + 1], sizeof(coordinate)) == 0;
+      moves++;
+    }
+  }
+  pthread_join(thread, NULL);
+  bool same = count == reference_count && moves == PREPARE_MOVES
+    && memcmp(prepared, reference, sizeof(struct frame_word) * count) == 0;
+  printf("prepared frames, %i moves, %zu cycles, %i frames per block:\n", PREPARE_MOVES, count, preparer->block_frames);
+  printf("  words as step() writes them: %s; blocks of whole frames: %s; moves end in place: %s\n",
+    expect(same) ? "ok" : "FAIL", expect(whole_frames) ? "ok" : "FAIL", expect(ends) ? "ok" : "FAIL");
+
+  // the worker's side only, per frame, one block after the other as the preparer turns them out
+  double *samples = malloc(sizeof(double) * PREPARE_SAMPLES);
+  struct step_clock clock = { 0 };
+  struct step_progress progress = { 0 };
+  struct eggbot_config worker_config = config;
+  pthread_create(&thread, NULL, prepare_moves_task, preparer);
+  int sample = 0;
+  for (int m = 0; sample < PREPARE_SAMPLES; m = (m + 1) % PREPARE_MOVES)
+  {
+    ringbuffer_queue(tasks, (struct task) { .from = points[m], .to = points[m + 1], .dt = dts[m] });
+    while (ringbuffer_peek(tasks) || ringbuffer_peek(preparer->blocks))
+    {
+      if (!ringbuffer_peek(preparer->blocks)) continue;
+      struct task task = ringbuffer_take(preparer->blocks);
+      const struct frame_block *block = task.block;
+      double start = secs();
+      step_block(&worker_config, &clock, &progress, block);
+      if (block->count >= length && sample < PREPARE_SAMPLES)
+      {
+        samples[sample++] = (secs() - start) * 1e9 / (block->count / length);
+      }
+      if (block->last) preparer_feedback(preparer, config.cycles_per_s, 0);
+    }
+  }
+  ringbuffer_queue(tasks, (struct task) { .quit = true });
+  while (!ringbuffer_peek(preparer->blocks) || !ringbuffer_take(preparer->blocks).quit) { }
+  pthread_join(thread, NULL);
+  report("step_block", samples, PREPARE_SAMPLES, "ns/frame");
+
+  free(samples);
+  free(prepared);
+  free(reference);
+}
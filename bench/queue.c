@@ -0,0 +1,204 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ringbuffer.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define QUEUE_TASKS (1024 * 1024 * 4)
+#define QUEUE_LENGTH 16
+#define ROUND_TRIPS 20000
+// a job of bursts of short moves and runs of long ones, played back in real time
+#define TIMED_ROUNDS 2
+#define TIMED_SHORT_MOVES 100
+#define TIMED_SHORT_DT 0.002
+#define TIMED_LONG_MOVES 5
+#define TIMED_LONG_DT 0.1
+#define TIMED_LOW_WATER 0.1
+#define TIMED_HIGH_WATER 0.2
+
+// the producer alternates single and batched queueing; every task carries its sequence number
+static void *queue_producer(void *data)
+{
+  struct task_ring_buffer *buffer = data;
+  struct task batch[5];
+  int next = 0;
+  while (next < QUEUE_TASKS)
+  {
+    if (next % 2)
+    {
+      ringbuffer_queue(buffer, (struct task) { .from = { .egg = unit_steps(next++) } });
+      continue;
+    }
+    int count = min(5, QUEUE_TASKS - next);
+    for (int i = 0; i < count; i++)
+    {
+      batch[i] = (struct task) { .from = { .egg = unit_steps(next++) } };
+    }
+    ringbuffer_queue_n(buffer, batch, count);
+  }
+  ringbuffer_queue(buffer, (struct task) { .quit = true });
+  return NULL;
+}
+
+// hammer the ring buffer from two threads and check nothing gets lost, duplicated or reordered
+void bench_queue()
+{
+  struct task_ring_buffer *buffer = ringbuffer_init(QUEUE_LENGTH, INFINITY, INFINITY);
+  pthread_t producer;
+  double start = secs();
+  pthread_create(&producer, NULL, queue_producer, buffer);
+
+  struct task batch[8];
+  int expected = 0;
+  bool quit = false;
+  while (!quit)
+  {
+    size_t count;
+    if (expected % 3)
+    {
+      count = ringbuffer_take_n(buffer, batch, 8);
+    }
+    else if ((count = ringbuffer_peek(buffer)))
+    {
+      batch[0] = ringbuffer_take(buffer);
+    }
+
+    for (size_t i = 0; i < count && !quit; i++)
+    {
+      if (batch[i].quit)
+      {
+        quit = true;
+        break;
+      }
+      if (unit_step(batch[i].from.egg) != expected)
+      {
+        fprintf(stderr, "ring buffer: expected task %i, got %i\n", expected, unit_step(batch[i].from.egg));
+        abort();
+      }
+      expected++;
+    }
+  }
+  pthread_join(producer, NULL);
+  double end = secs();
+
+  if (expected != QUEUE_TASKS)
+  {
+    fprintf(stderr, "ring buffer: lost tasks, %i of %i arrived\n", expected, QUEUE_TASKS);
+    abort();
+  }
+  printf("ring buffer, %i tasks through %i slots:\n", QUEUE_TASKS, QUEUE_LENGTH);
+  printf("  %8.2f ns/task, order OK\n", (end - start) * 1e9 / QUEUE_TASKS);
+}
+
+struct echo
+{
+  struct task_ring_buffer *there, *back;
+};
+
+// hand every task straight back
+static void *queue_echo(void *data)
+{
+  struct echo *echo = data;
+  while (true)
+  {
+    // yield rather than spin so this also works with one core
+    while (!ringbuffer_peek(echo->there)) sched_yield();
+    struct task task = ringbuffer_take(echo->there);
+    ringbuffer_queue(echo->back, task);
+    if (task.quit) return NULL;
+  }
+}
+
+// one task there and back between two threads
+void bench_queue_latency()
+{
+  static double samples[ROUND_TRIPS];
+  struct echo echo = {
+    .there = ringbuffer_init(QUEUE_LENGTH, INFINITY, INFINITY),
+    .back = ringbuffer_init(QUEUE_LENGTH, INFINITY, INFINITY),
+  };
+  pthread_t thread;
+  pthread_create(&thread, NULL, queue_echo, &echo);
+
+  for (int i = 0; i < ROUND_TRIPS; i++)
+  {
+    double start = secs();
+    ringbuffer_queue(echo.there, (struct task) { .dt = i });
+    while (!ringbuffer_peek(echo.back)) sched_yield();
+    ringbuffer_take(echo.back);
+    samples[i] = (secs() - start) * 1e9;
+  }
+  ringbuffer_queue(echo.there, (struct task) { .quit = true });
+  pthread_join(thread, NULL);
+
+  printf("ring buffer round trip:\n");
+  report("queue, take, echo", samples, ROUND_TRIPS, "ns");
+}
+
+struct timed_producer
+{
+  struct task_ring_buffer *buffer;
+  double max_queued; // s, right after queueing a move
+};
+
+static void *timed_producer(void *data)
+{
+  struct timed_producer *producer = data;
+  for (int round = 0; round < TIMED_ROUNDS; round++)
+  {
+    for (int i = 0; i < TIMED_SHORT_MOVES + TIMED_LONG_MOVES; i++)
+    {
+      float dt = i < TIMED_SHORT_MOVES ? TIMED_SHORT_DT : TIMED_LONG_DT;
+      ringbuffer_queue(producer->buffer, (struct task) { .dt = dt });
+      double queued = ringbuffer_queued_time(producer->buffer);
+      if (queued > producer->max_queued) producer->max_queued = queued;
+    }
+  }
+  ringbuffer_queue(producer->buffer, (struct task) { .quit = true });
+  return NULL;
+}
+
+// the queue bounded by motion time: the consumer sleeps through each move on an absolute schedule,
+// like the worker does, and counts the times it finds the queue empty
+void bench_queue_time()
+{
+  struct timed_producer producer = {
+    .buffer = ringbuffer_init(4096, TIMED_LOW_WATER, TIMED_HIGH_WATER),
+  };
+  pthread_t thread;
+  pthread_create(&thread, NULL, timed_producer, &producer);
+
+  int underruns = 0;
+  while (!ringbuffer_wait(producer.buffer, 1));
+  double due = secs();
+  while (true)
+  {
+    if (!ringbuffer_peek(producer.buffer))
+    {
+      underruns++;
+      while (!ringbuffer_wait(producer.buffer, 1));
+      due = secs();
+    }
+    struct task task = ringbuffer_take(producer.buffer);
+    if (task.quit) break;
+    due += task.dt;
+    nap_secs(due - secs());
+  }
+  pthread_join(thread, NULL);
+
+  double job = TIMED_ROUNDS * (TIMED_SHORT_MOVES * TIMED_SHORT_DT + TIMED_LONG_MOVES * TIMED_LONG_DT);
+  printf(
+    "ring buffer by time, %.1f s job of %g ms and %g ms moves, watermarks %g/%g s:\n",
+    job, TIMED_SHORT_DT * 1e3, TIMED_LONG_DT * 1e3, TIMED_LOW_WATER, TIMED_HIGH_WATER
+  );
+  printf(
+    "  at most %.3f s queued (%s), %i underruns; 16 slots would hold %g to %g s\n",
+    producer.max_queued, expect(producer.max_queued <= TIMED_HIGH_WATER + TIMED_LONG_DT + 1e-6) ? "ok" : "OVER",
+    underruns, 16 * TIMED_SHORT_DT, 16 * TIMED_LONG_DT
+  );
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include "config.h"
+#include "motion.h"
+#include "step.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define STEP_FRAMES 16 // per sampled step() call
+#define STEP_SAMPLES 20000
+
+static double step_samples[STEP_SAMPLES];
+
+// time step() over and over on short moves; `advance` rolls the move on between calls
+static void bench_step_case(const char *name, struct eggbot_config *config, coordinate from, coordinate to, bool lock, bool advance)
+{
+  float dt = STEP_FRAMES * config->pwm_config.length_pow2 / config->cycles_per_s;
+  double delta_egg = unit_diff_f(from.egg, to.egg), delta_pen = unit_diff_f(from.pen, to.pen);
+
+  for (int i = 0; i < STEP_SAMPLES; i++)
+  {
+    double start = secs();
+    step(config, NULL, from, to, dt, lock);
+    step_samples[i] = (secs() - start) * 1e9 / STEP_FRAMES;
+    if (advance)
+    {
+      coordinate next = coord_advance(to, delta_egg, delta_pen, to.servo);
+      next.egg_speed = to.egg_speed;
+      next.pen_speed = to.pen_speed;
+      from = to;
+      to = next;
+    }
+  }
+  report(name, step_samples, STEP_SAMPLES, "ns/frame");
+  printf("  %-22s %10.0f frames/s, %.0f cycles/s\n", "", 1e9 / step_samples[STEP_SAMPLES / 2], 1e9 / step_samples[STEP_SAMPLES / 2] * config->pwm_config.length_pow2);
+}
+
+void bench_step()
+{
+  struct eggbot_config config = bench_config();
+  float dt = STEP_FRAMES * config.pwm_config.length_pow2 / config.cycles_per_s;
+  printf("step(), %i frames of %i cycles per call, %.1f us/frame budget:\n", STEP_FRAMES, config.pwm_config.length_pow2, US_PER_PWM);
+
+  coordinate rest = {{ 0 }};
+  rest.servo = 1;
+  bench_step_case("locked", &config, rest, rest, true, false);
+
+  coordinate from = rest;
+  from.egg_speed = 20;
+  from.pen_speed = -5;
+  coordinate to = coord_advance(from, from.egg_speed * dt, from.pen_speed * dt, from.servo);
+  to.egg_speed = from.egg_speed;
+  to.pen_speed = from.pen_speed;
+  bench_step_case("moving", &config, from, to, false, true);
+
+  coordinate lowered = rest;
+  lowered.servo = 0;
+  bench_step_case("servo transition", &config, rest, lowered, false, false);
+}
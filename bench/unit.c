@@ -0,0 +1,171 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "util.h"
+
+#include "bench.h"
+
+#define UNIT_OPS (1024 * 1024)
+#define UNIT_SAMPLES 31
+#define UNIT_JOB_MOVES 1000000 // a long job
+#define UNIT_CASES 100000
+
+static volatile float unit_sink;
+
+// the step + float substep position unit used to be, as the reference for the fixed point one
+typedef struct
+{
+  int step;
+  float substep;
+} float_unit;
+
+static float_unit float_unit_rebalance(float_unit u)
+{
+  while (u.substep >= 1.0)
+  {
+    u.step += 1;
+    u.substep -= 1.0;
+  }
+  while (u.substep < 0.0)
+  {
+    u.step -= 1;
+    u.substep += 1.0;
+  }
+  return u;
+}
+
+static float_unit float_unit_add(float_unit u, float f)
+{
+  u.substep += f;
+  return float_unit_rebalance(u);
+}
+
+static float float_unit_diff(float_unit from, float_unit to)
+{
+  to.step -= from.step;
+  to.substep -= from.substep;
+  to = float_unit_rebalance(to);
+  return (float) to.step + to.substep;
+}
+
+// a random position within a few thousand units either way, on the 2^-32 grid
+static unit random_unit()
+{
+  int64_t fixed = ((int64_t) (rand() % 8192 - 4096) << 32) | (uint32_t) rand() << 1;
+  return (unit) { fixed };
+}
+
+static bool check(const char *name, bool ok)
+{
+  printf("  %-40s %s\n", name, expect(ok) ? "ok" : "FAIL");
+  return ok;
+}
+
+// the properties positions rely on, checked against exact integer sums and the float reference
+static void check_unit()
+{
+  srand(3);
+
+  // a long job of eggcode moves, both ways. egg moves are 1/64 units, exact in fixed point;
+  // pen moves are 1/90 units, which round to 2^-32 each
+  unit egg = { 0 }, pen = { 0 };
+  float_unit float_egg = { 0 }, float_pen = { 0 };
+  long egg_steps = 0, pen_steps = 0;
+  for (int i = 0; i < UNIT_JOB_MOVES; i++)
+  {
+    int degg = rand() % 61 - 30, dpen = rand() % 41 - 20;
+    egg_steps += degg;
+    pen_steps += dpen;
+    egg = unit_add(egg, degg / (double) EGG_STEPS_PER_UNIT);
+    pen = unit_add(pen, dpen / (double) PEN_STEPS_PER_UNIT);
+    float_egg = float_unit_add(float_egg, degg / (float) EGG_STEPS_PER_UNIT);
+    float_pen = float_unit_add(float_pen, dpen / (float) PEN_STEPS_PER_UNIT);
+  }
+  double exact_pen = (double) pen_steps / PEN_STEPS_PER_UNIT;
+  double pen_error = fabs(unitf(pen) - exact_pen);
+  printf("unit properties, %i moves:\n", UNIT_JOB_MOVES);
+  printf(
+    "  drift after the job: fixed egg %.3g, pen %.3g units; float egg %.3g, pen %.3g units\n",
+    fabs(unitf(egg) - (double) egg_steps / EGG_STEPS_PER_UNIT), pen_error,
+    fabs(float_egg.step + (double) float_egg.substep - (double) egg_steps / EGG_STEPS_PER_UNIT),
+    fabs(float_pen.step + (double) float_pen.substep - exact_pen)
+  );
+  check("egg moves sum exactly", egg.fixed == egg_steps * (UNIT_ONE / EGG_STEPS_PER_UNIT));
+  check("pen moves within 2^-33 each", pen_error <= UNIT_JOB_MOVES * 0x1p-33);
+
+  bool split = true, diff = true, roundtrip = true, quarter = true, phase = true, small = true;
+  for (int i = 0; i < UNIT_CASES; i++)
+  {
+    unit a = random_unit(), b = random_unit();
+    double x = unitf(a);
+
+    // step and substep mean what they did: floor, and the rest in [0, 1)
+    float_unit reference = float_unit_rebalance((float_unit) { .substep = x - floor(x), .step = (int) floor(x) });
+    split &= unit_step(a) == (int) floor(x) && unit_substep(a) >= 0 && unit_substep(a) < 1
+      && unit_step(a) + unit_substep(a) == x
+      && (unit_step(a) == reference.step || reference.substep == 0);
+
+    // differences are exact, antisymmetric, and close to the float ones
+    double d = unit_diff_f(a, b);
+    float_unit float_a = { unit_step(a), unit_substep(a) }, float_b = { unit_step(b), unit_substep(b) };
+    diff &= d == -unit_diff_f(b, a) && d == unitf(b) - unitf(a)
+      && fabs(d - float_unit_diff(float_a, float_b)) <= 2e-3;
+
+    // adding a difference lands exactly on the other end
+    roundtrip &= unit_add(a, d).fixed == b.fixed;
+
+    // lock mode's rounding to quarter steps, as the float version did it
+    double rounded = unit_step(a) + floor(unit_substep(a) / 0.25 + 0.5) * 0.25;
+    quarter &= unitf(unit_round_quarter(a)) == rounded;
+
+    // winding phase is the substep
+    phase &= unit_phase(a) == (uint64_t) ldexp(unit_substep(a), 64);
+
+    // a small move, say a pen step, is kept to 2^-33
+    double f = (rand() % 2001 - 1000) / 90000.0;
+    small &= fabs(unit_diff_f(a, unit_add(a, f)) - f) <= 0x1p-33;
+  }
+  check("step/substep split matches floor", split);
+  check("diff exact and antisymmetric", diff);
+  check("add(a, diff(a, b)) == b", roundtrip);
+  check("quarter rounding matches round_frac", quarter);
+  check("phase matches substep", phase);
+  check("small moves within 2^-33", small);
+}
+
+void bench_unit()
+{
+  check_unit();
+
+  double add_ns[UNIT_SAMPLES], diff_ns[UNIT_SAMPLES];
+  printf("unit math, %i ops per sample:\n", UNIT_OPS);
+
+  for (int sample = 0; sample < UNIT_SAMPLES; sample++)
+  {
+    unit position = { 0 };
+    double start = secs();
+    for (int i = 0; i < UNIT_OPS; i++)
+    {
+      // the kind of fractional moves eggcode makes, both ways
+      position = unit_add(position, (i & 1) ? 7 / 64.0 : -3 / 90.0);
+    }
+    add_ns[sample] = (secs() - start) * 1e9 / UNIT_OPS;
+    unit_sink = unitf(position);
+
+    unit from = unit_from_f(-1234 + 0.25);
+    double total = 0;
+    start = secs();
+    for (int i = 0; i < UNIT_OPS; i++)
+    {
+      unit to = unit_from_f(i + (i & 63) / 64.0);
+      total += unit_diff_f(from, to);
+    }
+    diff_ns[sample] = (secs() - start) * 1e9 / UNIT_OPS;
+    unit_sink = total;
+  }
+  report("unit_add", add_ns, UNIT_SAMPLES, "ns/op");
+  report("unit_diff_f", diff_ns, UNIT_SAMPLES, "ns/op");
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "pi.h"
+#include "trace.h"
+#include "util.h"
+#include "waveform.h"
+
+#include "bench.h"
+
+#define WAVEFORM_MOVE_S 0.02
+#define WAVEFORM_TRACE_CAPACITY (64 * 1024)
+
+// replay with the pins set to `preset` first, and return the levels after every write of the replay
+static uint32_t *replay_from(const struct waveform *waveform, uint32_t preset, size_t *count)
+{
+  volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
+  volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
+  uint32_t pin_mask = waveform->header->pin_mask;
+  trace_start(WAVEFORM_TRACE_CAPACITY);
+  gpio_write(set_reg, clr_reg, preset & pin_mask, ~preset & pin_mask);
+  bool abort = false;
+  waveform_replay(waveform, set_reg, clr_reg, &abort);
+
+  size_t total = trace_finish();
+  uint32_t *levels = malloc(sizeof(uint32_t) * total);
+  uint32_t level = preset & pin_mask;
+  // the first entry is the preset
+  *count = total - 1;
+  for (size_t i = 1; i < total; i++)
+  {
+    level = (level & ~gpio_trace->entries[i].clr) | gpio_trace->entries[i].set;
+    levels[i - 1] = level;
+  }
+  free(gpio_trace->entries);
+  free(gpio_trace);
+  gpio_trace = NULL;
+  return levels;
+}
+
+// a compiled move replayed with every pin already on, as hold() or a move before it can leave them,
+// has to drive the pins exactly as one replayed from all pins off
+void bench_waveform()
+{
+  char filename[] = "/tmp/raspberryegg-bench-XXXXXX";
+  int fd = mkstemp(filename);
+  close(fd);
+
+  struct eggbot_config config = bench_config();
+  config.dry_run = true;
+  struct waveform_writer *writer = waveform_create(filename, config);
+  coordinate from = {{ 0 }};
+  from.servo = 1.0;
+  from.egg_speed = 10;
+  from.pen_speed = -5;
+  coordinate to = coord_advance(from, from.egg_speed * WAVEFORM_MOVE_S, from.pen_speed * WAVEFORM_MOVE_S, 1.0);
+  waveform_compile(writer, from, to, WAVEFORM_MOVE_S);
+  waveform_finish(writer, to);
+
+  struct waveform *waveform = waveform_open(filename);
+  size_t clean_count, preset_count;
+  uint32_t *clean = replay_from(waveform, 0, &clean_count);
+  uint32_t *preset = replay_from(waveform, ~0u, &preset_count);
+  // the first write clears what the first record doesn't set, which the first record then sets anyway
+  size_t stale = 0;
+  for (size_t i = 1; i < clean_count && i < preset_count; i++)
+  {
+    stale += clean[i] != preset[i];
+  }
+  bool same = clean_count == preset_count && stale == 0;
+  printf("waveform replay, %.0f ms move, %llu records:\n", WAVEFORM_MOVE_S * 1e3, (unsigned long long) waveform->header->record_count);
+  printf("  from all pins on, levels as from all off: %s (%zu writes differ)\n", expect(same) ? "ok" : "STALE PINS", stale);
+  free(clean);
+  free(preset);
+  waveform_close(waveform);
+  unlink(filename);
+}
@@ -0,0 +1,139 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion.h"
+#include "util.h"
+#include "words.h"
+
+#include "bench.h"
+
+#define WORDS_CASES 20000
+#define WORDS_BLOCK 16 // frames at once, as a block of precomputed frames would be
+#define WORDS_MAX_LENGTH 130
+#define WORDS_TIMED_FRAMES (1024 * 16)
+#define WORDS_SAMPLES 31
+
+static volatile uint32_t words_sink;
+
+static uint32_t random_bits()
+{
+  return (uint32_t) rand() << 16 ^ (uint32_t) rand();
+}
+
+// a limit around the frame, past both ends now and then; servo limits go far out either way
+static int random_limit(int length)
+{
+  switch (rand() % 16)
+  {
+    case 0: return INT_MIN;
+    case 1: return INT_MAX;
+    case 2: return -(rand() % 100000);
+    case 3: return rand() % 100000;
+    default: return rand() % (length + 21) - 10;
+  }
+}
+
+static struct frame random_frame(int length)
+{
+  return (struct frame) {
+    .pwm_limit_egg_winding1 = random_limit(length),
+    .pwm_limit_egg_winding2 = random_limit(length),
+    .pwm_limit_pen_winding1 = random_limit(length),
+    .pwm_limit_pen_winding2 = random_limit(length),
+    .bits_egg_winding1 = random_bits(),
+    .bits_egg_winding2 = random_bits(),
+    .bits_pen_winding1 = random_bits(),
+    .bits_pen_winding2 = random_bits(),
+    .bit_servo = random_bits(),
+    .servo_to_low = random_limit(length),
+    .servo_to_high = random_limit(length),
+  };
+}
+
+// the vector kernel against the one-cycle-at-a-time reference, word for word, on random frames of
+// every length up to past two vectors' worth, in blocks, from random levels
+static bool check_words(struct frame_word *words, struct frame_word *reference)
+{
+  srand(4);
+  struct frame frames[WORDS_BLOCK];
+  bool same = true;
+  for (int i = 0; i < WORDS_CASES && same; i++)
+  {
+    int length = 1 + i % WORDS_MAX_LENGTH;
+    int count = 1 + rand() % WORDS_BLOCK;
+    for (int f = 0; f < count; f++)
+    {
+      frames[f] = random_frame(length);
+    }
+    uint32_t last = random_bits(), reference_last = last;
+    frame_words(frames, count, length, &last, words);
+    frame_words_scalar(frames, count, length, &reference_last, reference);
+    same = last == reference_last && memcmp(words, reference, sizeof(struct frame_word) * count * length) == 0;
+  }
+  return same;
+}
+
+// the words for a real frame, as the loop engine asks for them
+static double time_words(void (*fn)(const struct frame *, int, int, uint32_t *, struct frame_word *), const struct frame *frames, int length, struct frame_word *words)
+{
+  uint32_t last = 0;
+  double start = secs();
+  for (int i = 0; i < WORDS_TIMED_FRAMES; i++)
+  {
+    fn(&frames[i], 1, length, &last, words);
+  }
+  double elapsed = secs() - start;
+  words_sink = last ^ words[length - 1].set;
+  return elapsed * 1e9 / WORDS_TIMED_FRAMES;
+}
+
+void bench_words()
+{
+  struct frame_word *words = NULL, *reference = NULL;
+  int capacity = 0, reference_capacity = 0;
+  frame_words_buffer(&words, &capacity, WORDS_BLOCK * WORDS_MAX_LENGTH);
+  frame_words_buffer(&reference, &reference_capacity, WORDS_BLOCK * WORDS_MAX_LENGTH);
+
+#ifdef __SSE2__
+  const char *kernel = "sse2";
+#else
+  const char *kernel = "scalar";
+#endif
+  printf("frame words, %s kernel:\n", kernel);
+  printf("  matches the scalar reference on %i random blocks: %s\n", WORDS_CASES, expect(check_words(words, reference)) ? "ok" : "FAIL");
+
+  // frames from a real move, every cycle of the way, at bench_config()'s 64 cycles per frame
+  struct eggbot_config config = bench_config();
+  int length = config.pwm_config.length_pow2;
+  coordinate from = {{ 0 }};
+  from.egg_speed = 20;
+  from.pen_speed = -5;
+  from.servo = 0.5;
+  double dt = (double) WORDS_TIMED_FRAMES * length / config.cycles_per_s;
+  coordinate to = coord_advance(from, from.egg_speed * dt, from.pen_speed * dt, 0.5);
+  int cycles = WORDS_TIMED_FRAMES * length;
+  struct motion motion;
+  motion_init(&motion, &config, from, to, dt, cycles, false);
+  struct frame *frames = malloc(sizeof(struct frame) * WORDS_TIMED_FRAMES);
+  for (int i = 0; i < WORDS_TIMED_FRAMES; i++)
+  {
+    motion_frame(&motion, &config, i * length, i * length / config.cycles_per_s, &frames[i]);
+  }
+
+  double scalar_ns[WORDS_SAMPLES], vector_ns[WORDS_SAMPLES];
+  for (int sample = 0; sample < WORDS_SAMPLES; sample++)
+  {
+    scalar_ns[sample] = time_words(frame_words_scalar, frames, length, words);
+    vector_ns[sample] = time_words(frame_words, frames, length, words);
+  }
+  printf("  %i frames of %i cycles:\n", WORDS_TIMED_FRAMES, length);
+  report("frame_words_scalar", scalar_ns, WORDS_SAMPLES, "ns/frame");
+  report("frame_words", vector_ns, WORDS_SAMPLES, "ns/frame");
+
+  free(frames);
+  free(words);
+  free(reference);
+}
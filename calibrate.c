@@ -0,0 +1,212 @@
+#include <elf.h>
+#include <link.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "calibrate.h"
+#include "config.h"
+#include "step.h"
+#include "util.h"
+
+#define CALIBRATION_MAGIC "EGGCAL\0\0"
+#define CALIBRATION_VERSION 1
+
+// what has to match for a cached calibration to be tried at all
+struct calibration_key
+{
+  uint32_t backend; // the loop runs at another speed against memory
+  char model[128];
+  char governor[32];
+  uint64_t max_khz;
+  uint8_t build_id[32];
+  uint32_t build_id_len;
+};
+
+struct calibration_file
+{
+  char magic[8];
+  uint32_t version;
+  struct calibration_key key;
+  double cycles_per_s;
+  int32_t cycles_per_pwm;
+};
+
+// first line of `path`, without the newline; empty if it can't be read
+static void read_line(const char *path, char *buffer, size_t size)
+{
+  buffer[0] = 0;
+  FILE *file = fopen(path, "r");
+  if (!file) return;
+  if (fgets(buffer, size, file)) buffer[strcspn(buffer, "\n")] = 0;
+  fclose(file);
+}
+
+// "Model" (the board) on a pi, else "Hardware", else the "model name" of the first cpu
+static void read_cpu_model(char *buffer, size_t size)
+{
+  static const char *fields[] = { "Model", "Hardware", "model name" };
+  buffer[0] = 0;
+  FILE *file = fopen("/proc/cpuinfo", "r");
+  if (!file) return;
+
+  char line[256];
+  int best = 3;
+  while (fgets(line, sizeof(line), file))
+  {
+    char *colon = strchr(line, ':');
+    if (!colon) continue;
+    for (int i = 0; i < best; i++)
+    {
+      if (strncmp(line, fields[i], strlen(fields[i])) != 0) continue;
+
+      line[strcspn(line, "\n")] = 0;
+      snprintf(buffer, size, "%s", colon[1] ? colon + 2 : "");
+      best = i;
+      break;
+    }
+  }
+  fclose(file);
+}
+
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+  struct calibration_key *key = data;
+  // the first object is the executable itself
+  for (int i = 0; i < info->dlpi_phnum; i++)
+  {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type != PT_NOTE) continue;
+
+    const char *note = (const char*) (info->dlpi_addr + phdr->p_vaddr);
+    const char *end = note + phdr->p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end)
+    {
+      const ElfW(Nhdr) *header = (const ElfW(Nhdr)*) note;
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const uint8_t *desc = (const uint8_t*) name + ((header->n_namesz + 3) & ~3);
+      if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0)
+      {
+        key->build_id_len = header->n_descsz < sizeof(key->build_id) ? header->n_descsz : sizeof(key->build_id);
+        memcpy(key->build_id, desc, key->build_id_len);
+        return 1;
+      }
+      note = (const char*) desc + ((header->n_descsz + 3) & ~3);
+    }
+  }
+  return 1;
+}
+
+static struct calibration_key calibration_key(enum gpio_backend backend, int core)
+{
+  struct calibration_key key;
+  memset(&key, 0, sizeof(key));
+  key.backend = backend;
+  read_cpu_model(key.model, sizeof(key.model));
+
+  char path[128], value[32];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%i/cpufreq/scaling_governor", core);
+  read_line(path, key.governor, sizeof(key.governor));
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%i/cpufreq/scaling_max_freq", core);
+  read_line(path, value, sizeof(value));
+  key.max_khz = strtoull(value, NULL, 10);
+
+  dl_iterate_phdr(find_build_id, &key);
+  return key;
+}
+
+// cycles/s of `cycles` cycles of step() on the calibration config
+static double measure(struct eggbot_config *config, int cycles)
+{
+  coordinate from = {{ 0 }};
+  coordinate to = {{ 0 }};
+  config->cycles_per_s = CALIBRATION_CYCLES; // so dt = 1 is all of them
+  double start = secs();
+  step(config, NULL, from, to, (float) cycles / CALIBRATION_CYCLES, false);
+  return cycles / (secs() - start);
+}
+
+static bool load_cache(const char *cache_path, const struct calibration_key *key, struct calibration *calibration)
+{
+  struct calibration_file file;
+  FILE *cache = fopen(cache_path, "r");
+  if (!cache) return false;
+
+  bool res = fread(&file, sizeof(file), 1, cache) == 1
+    && memcmp(file.magic, CALIBRATION_MAGIC, sizeof(file.magic)) == 0
+    && file.version == CALIBRATION_VERSION;
+  fclose(cache);
+  if (!res) return false;
+
+  if (memcmp(&file.key, key, sizeof(*key)) != 0)
+  {
+    printf("calibration cache is for another cpu, cpu setting or build\n");
+    return false;
+  }
+  *calibration = (struct calibration) { .cycles_per_s = file.cycles_per_s, .cycles_per_pwm = file.cycles_per_pwm };
+  return true;
+}
+
+static void save_cache(const char *cache_path, const struct calibration_key *key, struct calibration calibration)
+{
+  struct calibration_file file;
+  memset(&file, 0, sizeof(file));
+  memcpy(file.magic, CALIBRATION_MAGIC, sizeof(file.magic));
+  file.version = CALIBRATION_VERSION;
+  file.key = *key;
+  file.cycles_per_s = calibration.cycles_per_s;
+  file.cycles_per_pwm = calibration.cycles_per_pwm;
+
+  FILE *cache = fopen(cache_path, "w");
+  if (!cache || fwrite(&file, sizeof(file), 1, cache) != 1 || fclose(cache) != 0)
+  {
+    // only costs time on the next start
+    fprintf(stderr, "warn: can't write calibration cache %s\n", cache_path);
+  }
+}
+
+struct calibration calibrate(struct eggbot_config *config, enum gpio_backend backend, int core, const char *cache_path, bool use_cache)
+{
+  struct calibration_key key = calibration_key(backend, core);
+  struct calibration calibration;
+
+  if (use_cache && load_cache(cache_path, &key, &calibration))
+  {
+    // a probe this short is thrown off by a single preemption; the fastest run is the one that wasn't
+    double probe = 0;
+    for (int i = 0; i < CALIBRATION_PROBE_RUNS; i++)
+    {
+      probe = fmax(probe, measure(config, CALIBRATION_PROBE_CYCLES));
+    }
+    double error = probe / calibration.cycles_per_s - 1;
+    if (fabs(error) < CALIBRATION_TOLERANCE)
+    {
+      printf(
+        "cached calibration: %f cycles/s, %i cycles/pwm (probe %+.1f%%)\n",
+        calibration.cycles_per_s, calibration.cycles_per_pwm, error * 100
+      );
+      return calibration;
+    }
+    printf("cached calibration is off by %+.1f%%, recalibrating\n", error * 100);
+  }
+
+  burn_cpu();
+
+  printf("calibrate stepper loop...\n");
+  double start = secs();
+  calibration.cycles_per_s = measure(config, CALIBRATION_CYCLES);
+  double end = secs();
+  printf("calibrate stepper loop OK\n");
+  printf("%f seconds for %i stepper control cycles\n", end - start, CALIBRATION_CYCLES);
+  double us_per_cycle = 1000000.0 / calibration.cycles_per_s;
+  calibration.cycles_per_pwm = next_pow2((int)(US_PER_PWM / us_per_cycle));
+  printf(
+    "%f us/cycle; %f cycles/s, %i cycles/pwm\n",
+    us_per_cycle, calibration.cycles_per_s, calibration.cycles_per_pwm
+  );
+
+  save_cache(cache_path, &key, calibration);
+  return calibration;
+}
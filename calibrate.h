@@ -0,0 +1,25 @@
+#ifndef RASPBERRYEGG_CALIBRATE_H
+#define RASPBERRYEGG_CALIBRATE_H
+
+#include <stdbool.h>
+
+#include "motion.h"
+#include "pi.h"
+
+// how fast step() runs on this machine, as measured at startup.
+// measuring it properly takes a cpu burn in and a full CALIBRATION_CYCLES run, so the result is
+// kept on disk. it's reused as long as the gpio backend, the cpu, its frequency settings and the
+// binary are the same, and a few short probe runs agree with it.
+
+struct calibration
+{
+  double cycles_per_s;
+  int cycles_per_pwm;
+};
+
+// `config` is what calibration runs step() on; its cycles_per_s is overwritten.
+// `backend` and `core`, the cpu the worker will run on, go into the cache key.
+// with `use_cache` unset, always recalibrate (and update the cache).
+struct calibration calibrate(struct eggbot_config *config, enum gpio_backend backend, int core, const char *cache_path, bool use_cache);
+
+#endif
@@ -0,0 +1,35 @@
+#include "coalesce.h"
+
+bool coalescer_push(struct coalescer *coalescer, int dt_ms, int dpen, int degg)
+{
+  if (dt_ms <= 0 || (dpen == 0 && degg == 0)) return false;
+
+  if (coalescer->count == 0)
+  {
+    coalescer->dt_ms = coalescer->dpen = coalescer->degg = 0;
+  }
+  else
+  {
+    if (coalescer->count == COALESCE_MAX_MOVES || coalescer->dt_ms + dt_ms > COALESCE_MAX_MS) return false;
+
+    double total_ms = coalescer->dt_ms + dt_ms;
+    double total_pen = coalescer->dpen + dpen, total_egg = coalescer->degg + degg;
+    // the last end is where the merged move ends as well
+    for (int i = 0; i < coalescer->count; i++)
+    {
+      double f = coalescer->end_ms[i] / total_ms;
+      double error_pen = coalescer->end_pen[i] - total_pen * f;
+      double error_egg = coalescer->end_egg[i] - total_egg * f;
+      if (error_pen * error_pen + error_egg * error_egg > COALESCE_ERROR * COALESCE_ERROR) return false;
+    }
+  }
+
+  coalescer->dt_ms += dt_ms;
+  coalescer->dpen += dpen;
+  coalescer->degg += degg;
+  coalescer->end_ms[coalescer->count] = coalescer->dt_ms;
+  coalescer->end_pen[coalescer->count] = coalescer->dpen;
+  coalescer->end_egg[coalescer->count] = coalescer->degg;
+  coalescer->count++;
+  return true;
+}
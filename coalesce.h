@@ -0,0 +1,38 @@
+#ifndef RASPBERRYEGG_COALESCE_H
+#define RASPBERRYEGG_COALESCE_H
+
+#include <stdbool.h>
+
+#include "config.h"
+
+// merges runs of consecutive SM moves into one, as long as the merged move never strays more than
+// COALESCE_ERROR eggcode steps from where the original moves had the pen at the same time. that holds
+// for nearly straight runs at nearly constant speed, which is what dense curves are exported as.
+// both paths are straight between the original moves' ends, so checking there bounds the error everywhere.
+// all values are SM arguments: ms and eggcode steps.
+
+struct coalescer
+{
+  int count; // moves merged so far
+  int dt_ms, dpen, degg; // of the merged move
+  // where each merged move ended, and when, from the start of the first
+  int end_ms[COALESCE_MAX_MOVES];
+  int end_pen[COALESCE_MAX_MOVES];
+  int end_egg[COALESCE_MAX_MOVES];
+};
+
+static inline bool coalescer_empty(struct coalescer *coalescer)
+{
+  return coalescer->count == 0;
+}
+
+// merge the move into the pending one. returns false, leaving it as it was, if that goes over the
+// error, or the move stands still or takes no time
+bool coalescer_push(struct coalescer *coalescer, int dt_ms, int dpen, int degg);
+
+static inline void coalescer_clear(struct coalescer *coalescer)
+{
+  coalescer->count = 0;
+}
+
+#endif
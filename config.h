@@ -17,6 +17,8 @@
 #define BASE_PWM_FACTOR 0.55
 // "lock" factor for holding the pen when idling
 #define LOCK_PWM_FACTOR 0.9
+// holding still while the queue is empty, at this fraction of full current
+#define HOLD_PWM_FACTOR 0.5
 
 // egg rotation stepper in1/in2 (winding 1)
 #define STEPPER_EGG_PIN1 4
@@ -32,7 +34,91 @@
 #define STEPPER_PEN_PIN3 24
 #define STEPPER_PEN_PIN4 25
 
+// lookahead planner (-p), in units (one full step cycle)
+// number of SM moves planned ahead
+#define PLANNER_LOOKAHEAD 32
+// acceleration limit in units/s^2
+#define PLANNER_EGG_ACCEL 400.0
+#define PLANNER_PEN_ACCEL 400.0
+// largest speed change in units/s taken without a ramp, at the junction of two moves
+#define PLANNER_EGG_JUMP 2.0
+#define PLANNER_PEN_JUMP 2.0
+// speed limit in units/s
+#define PLANNER_EGG_MAX_SPEED 40.0
+#define PLANNER_PEN_MAX_SPEED 20.0
+// s; shorter accelerate/cruise/decelerate phases are left out and their distance given to the rest of the move
+#define PLANNER_MIN_PHASE 0.0001
+
+// the pen moves within these bounds, in units from where it started
+#define PEN_LOW -5
+#define PEN_HIGH 5
+// eggcode steps (SM's degg and dpen) to a unit
+#define EGG_STEPS_PER_UNIT 64
+#define PEN_STEPS_PER_UNIT 90
+// eggcode egg steps to one turn of the egg
+#define EGG_STEPS_PER_TURN 3200
+// travel optimizer (-O): 2-opt tries reversing runs of up to this many strokes, for at most this many passes
+#define OPTIMIZE_WINDOW 32
+#define OPTIMIZE_PASSES 16
+// move coalescing (-m): how far in eggcode steps a merged move may stray from the moves it replaces,
+// and how many moves and ms at most go into one
+#define COALESCE_ERROR 1.0
+#define COALESCE_MAX_MOVES 64
+#define COALESCE_MAX_MS 500
+// pen changes overlapped with travel (-L): at most this many pen-up moves are held back for a pen drop to start during
+#define OVERLAP_MOVES 64
+
+// machines driven at once with -M, each on its own gpios, queue and worker core
+#define MACHINES_MAX 4
+// the worker's queue holds up to QUEUE_HIGH_WATER s of moves; once there, the reader waits until it's down
+// to QUEUE_LOW_WATER. QUEUE_SLOTS caps the number of tasks, even if they're very short
+#define QUEUE_LOW_WATER 0.25
+#define QUEUE_HIGH_WATER 0.5
+#define QUEUE_SLOTS 4096
+// bytes of eggcode read at a time from stdin or a pipe; also the longest line those take
+#define EGGCODE_STREAM_BUFFER (64 * 1024)
+// prepared frames (-P): words per block (rounded down to whole frames, at least one), blocks queued
+// ahead of the worker, and how long in s the worker spins for a late block before it gives up and holds
+#define PREPARE_BLOCK_WORDS 4096
+#define PREPARE_BLOCKS 8
+#define PREPARE_SPIN 0.0005
+
 #define US_PER_PWM 40.0
 #define CALIBRATION_CYCLES (1024 * 1024 * 8)
+// calibration results are kept here, and checked with a run of this many cycles before being reused
+#define CALIBRATION_CACHE "/var/tmp/raspberryegg-calibration"
+#define CALIBRATION_PROBE_CYCLES (CALIBRATION_CYCLES / 64)
+#define CALIBRATION_PROBE_RUNS 3
+// how far the probe may be off the cached rate. a changed governor or clock is off by far more;
+// run to run noise is taken care of by the online rate correction
+#define CALIBRATION_TOLERANCE 0.25
+// finest pwm resolution the edge engine runs at; it's also held to what the cycle counter resolves
+#define EDGE_PWM_LENGTH_MAX 1024
+// the hold pwm: frame length in s and cycles per frame; the worker sleeps between edges
+#define HOLD_PWM_PERIOD 0.001
+#define HOLD_PWM_LENGTH 64
+// s before a servo edge that the worker stops sleeping and spins, as waking up is a bit late
+#define HOLD_SPIN 0.0002
+// jobs the daemon queues up, and the longest command line it takes
+#define DAEMON_MAX_JOBS 64
+#define DAEMON_LINE_MAX 4096
+// s of running it takes the cycle rate estimate to mostly follow a change in the measured rate
+#define RATE_TIME_CONSTANT 2.0
+// how far a segment may be stretched or squeezed to get back on schedule, as a fraction of its length
+#define DEADLINE_SLACK 0.5
+// s between loop rate reports with -v
+#define VERBOSE_INTERVAL 5.0
+// bytes of worker stack touched up front in real-time mode
+#define RT_STACK_PREFAULT (256 * 1024)
+// gpio changes kept by -t
+#define TRACE_CAPACITY (1024 * 1024 * 4)
+// pwm resolution of compiled waveforms, in ticks per US_PER_PWM frame
+#define COMPILE_TICKS_PER_PWM 64
+// s between the samples of a simulated trajectory (-T)
+#define SIMULATE_SAMPLE_PERIOD 0.01
+// how far over the planner limits a simulated move may go before it's flagged, for float rounding
+#define SIMULATE_TOLERANCE 1.01
+// flagged moves listed per file; the rest are only counted
+#define SIMULATE_MAX_WARNINGS 10
 
 #endif
@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+
+static const char *state_names[] = {
+  [DAEMON_IDLE] = "idle",
+  [DAEMON_WAITING_FOR_PEN] = "waiting for pen",
+  [DAEMON_PRINTING] = "printing",
+};
+
+static struct sockaddr_un socket_address(const char *socket_path)
+{
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (strlen(socket_path) >= sizeof(address.sun_path))
+  {
+    fprintf(stderr, "socket path too long: %s\n", socket_path);
+    abort();
+  }
+  strcpy(address.sun_path, socket_path);
+  return address;
+}
+
+// answer one command line into `reply`
+static void daemon_command(struct daemon *daemon, char *line, char *reply, size_t size)
+{
+  char *argument = strchr(line, ' ');
+  if (argument) *argument++ = 0;
+
+  pthread_mutex_lock(&daemon->lock);
+  if (strcmp(line, "print") == 0)
+  {
+    if (!argument || argument[0] != '/')
+    {
+      snprintf(reply, size, "error print takes an absolute path");
+    }
+    else if (access(argument, R_OK) != 0)
+    {
+      snprintf(reply, size, "error can't read %s: %s", argument, strerror(errno));
+    }
+    else if (daemon->job_count == DAEMON_MAX_JOBS)
+    {
+      snprintf(reply, size, "error job queue is full");
+    }
+    else
+    {
+      daemon->jobs[(daemon->first_job + daemon->job_count++) % DAEMON_MAX_JOBS] = strdup(argument);
+      snprintf(reply, size, "ok queued as job %i", daemon->jobs_done + (int) daemon->job_count + (daemon->current ? 1 : 0));
+    }
+  }
+  else if (strcmp(line, "pen") == 0)
+  {
+    // a pen given ahead of time would start the next job before the pen is in
+    if (daemon->state != DAEMON_WAITING_FOR_PEN)
+    {
+      snprintf(reply, size, "error not waiting for a pen");
+    }
+    else
+    {
+      daemon->pen_ready = true;
+      snprintf(reply, size, "ok");
+    }
+  }
+  else if (strcmp(line, "pause") == 0 || strcmp(line, "resume") == 0)
+  {
+    daemon->paused = strcmp(line, "pause") == 0;
+    snprintf(reply, size, "ok");
+  }
+  else if (strcmp(line, "status") == 0)
+  {
+    int written = snprintf(reply, size, "ok %s", state_names[daemon->state]);
+    if (daemon->current)
+    {
+      written += snprintf(reply + written, size - written, " %s line %i", daemon->current, daemon->line);
+    }
+    snprintf(
+      reply + written, size - written, "%s, %zu queued, %i done",
+      daemon->paused ? ", paused" : "", daemon->job_count, daemon->jobs_done
+    );
+  }
+  else if (strcmp(line, "quit") == 0)
+  {
+    daemon->quit = true;
+    snprintf(reply, size, "ok");
+  }
+  else
+  {
+    snprintf(reply, size, "error unknown command '%s'", line);
+  }
+  pthread_cond_broadcast(&daemon->changed);
+  pthread_mutex_unlock(&daemon->lock);
+}
+
+// answer each line the client sends until it hangs up
+static void daemon_serve(struct daemon *daemon, int fd)
+{
+  FILE *input = fdopen(fd, "r");
+  char line[DAEMON_LINE_MAX + 1], reply[DAEMON_LINE_MAX + 256];
+  while (fgets(line, sizeof(line), input))
+  {
+    line[strcspn(line, "\r\n")] = 0;
+    daemon_command(daemon, line, reply, sizeof(reply) - 1);
+    strcat(reply, "\n");
+    // the client may be gone already; that mustn't take the printer down with it
+    send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+  }
+  fclose(input);
+}
+
+static void *daemon_thread(void *data)
+{
+  struct daemon *daemon = (struct daemon*) data;
+  while (true)
+  {
+    int fd = accept(daemon->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      // daemon_close() shuts the socket down
+      if (errno == EINTR) continue;
+      break;
+    }
+    daemon_serve(daemon, fd);
+  }
+  return NULL;
+}
+
+struct daemon *daemon_start(const char *socket_path)
+{
+  struct sockaddr_un address = socket_address(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // a socket left over from a daemon that didn't get to clean up
+  unlink(socket_path);
+  if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 4) != 0)
+  {
+    fprintf(stderr, "can't listen on %s: ", socket_path);
+    perror(NULL);
+    abort();
+  }
+
+  struct daemon *daemon = calloc(1, sizeof(struct daemon));
+  daemon->socket_path = socket_path;
+  daemon->listen_fd = fd;
+  pthread_mutex_init(&daemon->lock, NULL);
+  pthread_cond_init(&daemon->changed, NULL);
+
+  int res = pthread_create(&daemon->thread, NULL, daemon_thread, daemon);
+  if (res != 0)
+  {
+    fprintf(stderr, "pthread_create() failed: %i\n", res);
+    abort();
+  }
+  printf("listening on %s\n", socket_path);
+  return daemon;
+}
+
+char *daemon_next_job(struct daemon *daemon)
+{
+  pthread_mutex_lock(&daemon->lock);
+  daemon->state = DAEMON_IDLE;
+  while (daemon->job_count == 0 && !daemon->quit)
+  {
+    pthread_cond_wait(&daemon->changed, &daemon->lock);
+  }
+  char *job = NULL;
+  if (!daemon->quit)
+  {
+    job = daemon->jobs[daemon->first_job];
+    daemon->first_job = (daemon->first_job + 1) % DAEMON_MAX_JOBS;
+    daemon->job_count--;
+    daemon->current = job;
+    daemon->line = 0;
+  }
+  pthread_mutex_unlock(&daemon->lock);
+  return job;
+}
+
+bool daemon_wait_pen(struct daemon *daemon)
+{
+  pthread_mutex_lock(&daemon->lock);
+  daemon->state = DAEMON_WAITING_FOR_PEN;
+  while (!daemon->pen_ready && !daemon->quit)
+  {
+    pthread_cond_wait(&daemon->changed, &daemon->lock);
+  }
+  // one pen per job
+  daemon->pen_ready = false;
+  daemon->state = DAEMON_PRINTING;
+  bool res = !daemon->quit;
+  pthread_mutex_unlock(&daemon->lock);
+  return res;
+}
+
+bool daemon_checkpoint(struct daemon *daemon, int line)
+{
+  pthread_mutex_lock(&daemon->lock);
+  daemon->line = line;
+  bool res = daemon->paused || daemon->quit;
+  pthread_mutex_unlock(&daemon->lock);
+  return res;
+}
+
+bool daemon_wait_resume(struct daemon *daemon)
+{
+  pthread_mutex_lock(&daemon->lock);
+  while (daemon->paused && !daemon->quit)
+  {
+    pthread_cond_wait(&daemon->changed, &daemon->lock);
+  }
+  bool res = !daemon->quit;
+  pthread_mutex_unlock(&daemon->lock);
+  return res;
+}
+
+void daemon_job_done(struct daemon *daemon)
+{
+  pthread_mutex_lock(&daemon->lock);
+  free(daemon->current);
+  daemon->current = NULL;
+  daemon->jobs_done++;
+  pthread_mutex_unlock(&daemon->lock);
+}
+
+void daemon_close(struct daemon *daemon)
+{
+  shutdown(daemon->listen_fd, SHUT_RDWR);
+  close(daemon->listen_fd);
+  pthread_join(daemon->thread, NULL);
+  unlink(daemon->socket_path);
+}
+
+static bool send_line(int fd, char *line)
+{
+  if (strlen(line) > DAEMON_LINE_MAX)
+  {
+    fprintf(stderr, "command too long: %s\n", line);
+    return false;
+  }
+  strcat(line, "\n");
+  if (send(fd, line, strlen(line), MSG_NOSIGNAL) < 0)
+  {
+    perror("can't send command");
+    return false;
+  }
+  return true;
+}
+
+int daemon_client(const char *socket_path, int argc, char **argv)
+{
+  struct sockaddr_un address = socket_address(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+  {
+    fprintf(stderr, "can't connect to %s: ", socket_path);
+    perror(NULL);
+    return 1;
+  }
+
+  // the daemon takes the rest of a print line as the path, so each file gets a print line of its own
+  bool print = strcmp(argv[0], "print") == 0 && argc > 1;
+  int lines = print ? argc - 1 : 1;
+  for (int i = 0; i < lines; i++)
+  {
+    char line[DAEMON_LINE_MAX + 2] = "";
+    if (print)
+    {
+      // the daemon doesn't share our working directory
+      char *path = realpath(argv[i + 1], NULL);
+      if (!path)
+      {
+        fprintf(stderr, "can't find %s: ", argv[i + 1]);
+        perror(NULL);
+        return 1;
+      }
+      snprintf(line, sizeof(line), "print %s", path);
+      free(path);
+    }
+    else
+    {
+      for (int k = 0; k < argc; k++)
+      {
+        snprintf(line + strlen(line), sizeof(line) - strlen(line), "%s%s", k ? " " : "", argv[k]);
+      }
+    }
+    if (!send_line(fd, line)) return 1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  // a reply per line, in order
+  FILE *input = fdopen(fd, "r");
+  char reply[DAEMON_LINE_MAX + 256];
+  int res = 0;
+  for (int i = 0; i < lines; i++)
+  {
+    if (!fgets(reply, sizeof(reply), input))
+    {
+      res = 1;
+      break;
+    }
+    fputs(reply, stdout);
+    if (strncmp(reply, "ok", 2) != 0) res = 1;
+  }
+  fclose(input);
+  return res;
+}
@@ -0,0 +1,68 @@
+#ifndef RASPBERRYEGG_DAEMON_H
+#define RASPBERRYEGG_DAEMON_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+
+// a long-running printer that takes its jobs over a unix socket instead of argv, so the worker,
+// calibration and held position outlive each job.
+// the protocol is one command per line, answered with one line starting with "ok" or "error":
+//   print <absolute path>  queue an eggcode or waveform file
+//   pen                    the next pen is in; the next job may start
+//   pause, resume          stop and restart feeding moves to the worker, which holds position meanwhile
+//   status                 what the printer is doing
+//   quit                   stop at the next move and shut down
+
+enum daemon_state
+{
+  DAEMON_IDLE,
+  DAEMON_WAITING_FOR_PEN,
+  DAEMON_PRINTING,
+};
+
+struct daemon
+{
+  const char *socket_path;
+  int listen_fd;
+  pthread_t thread; // answering the socket
+
+  // everything below is under `lock`; `changed` is signaled whenever any of it changes
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  char *jobs[DAEMON_MAX_JOBS];
+  size_t first_job, job_count;
+  bool pen_ready, paused, quit;
+  enum daemon_state state;
+  char *current; // job being printed
+  int line; // of the current job
+  int jobs_done;
+};
+
+// listen on `socket_path`; aborts if it can't
+struct daemon *daemon_start(const char *socket_path);
+
+// wait for the next job and take it; NULL once asked to quit. the caller frees it.
+char *daemon_next_job(struct daemon *daemon);
+
+// wait for the pen change before a job; false once asked to quit
+bool daemon_wait_pen(struct daemon *daemon);
+
+// note the line being printed; true if a pause or quit is pending
+bool daemon_checkpoint(struct daemon *daemon, int line);
+
+// block while paused; false once asked to quit
+bool daemon_wait_resume(struct daemon *daemon);
+
+void daemon_job_done(struct daemon *daemon);
+
+// stop answering and remove the socket
+void daemon_close(struct daemon *daemon);
+
+// send `argc` words as one command to the daemon at `socket_path` and print the answer.
+// returns the exit status for the client.
+int daemon_client(const char *socket_path, int argc, char **argv);
+
+#endif
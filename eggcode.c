@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "eggcode.h"
+
+bool eggcode_is_stream(const char *filename)
+{
+  struct stat stat_buf;
+  return strcmp(filename, "-") == 0 || (stat(filename, &stat_buf) == 0 && !S_ISREG(stat_buf.st_mode));
+}
+
+// move what's left of the buffer to its start and read on after it
+static void eggcode_fill(struct eggcode_parser *parser)
+{
+  size_t left = parser->end - parser->cursor;
+  if (left == EGGCODE_STREAM_BUFFER)
+  {
+    fprintf(stderr, "%s:%i: line longer than %i bytes\n", parser->filename, parser->line, EGGCODE_STREAM_BUFFER);
+    abort();
+  }
+  memmove(parser->buffer, parser->cursor, left);
+  parser->data = parser->cursor = parser->buffer;
+  parser->end = parser->buffer + left;
+
+  ssize_t got;
+  do
+  {
+    got = read(parser->fd, parser->buffer + left, EGGCODE_STREAM_BUFFER - left);
+  }
+  while (got < 0 && errno == EINTR);
+  if (got < 0)
+  {
+    fprintf(stderr, "can't read eggcode from %s: ", parser->filename);
+    perror(NULL);
+    abort();
+  }
+  parser->end += got;
+  parser->eof = got == 0;
+}
+
+static void eggcode_open_stream(struct eggcode_parser *parser, const char *filename, int fd)
+{
+  char *buffer = malloc(EGGCODE_STREAM_BUFFER);
+  *parser = (struct eggcode_parser) {
+    .filename = filename,
+    .data = buffer,
+    .end = buffer,
+    .buffer = buffer,
+    .cursor = buffer,
+    .line = 1,
+    .stream = true,
+    .fd = fd,
+  };
+  // binary eggcode needs its header up front, and is small enough to be a file anyway
+  while (!parser->eof && parser->end - parser->data < 8) eggcode_fill(parser);
+  if (parser->end - parser->data >= 8 && memcmp(parser->data, EGGCODE_BINARY_MAGIC, 8) == 0)
+  {
+    fprintf(stderr, "%s: binary eggcode can't be streamed, pass it as a file\n", filename);
+    abort();
+  }
+}
+
+void eggcode_open(struct eggcode_parser *parser, const char *filename)
+{
+  if (strcmp(filename, "-") == 0)
+  {
+    eggcode_open_stream(parser, filename, STDIN_FILENO);
+    return;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  struct stat stat;
+  if (fd < 0 || fstat(fd, &stat) != 0)
+  {
+    fprintf(stderr, "can't open eggcode file %s: ", filename);
+    perror(NULL);
+    abort();
+  }
+  if (!S_ISREG(stat.st_mode))
+  {
+    eggcode_open_stream(parser, filename, fd);
+    return;
+  }
+
+  const char *data = NULL;
+  if (stat.st_size > 0)
+  {
+    data = mmap(NULL, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      fprintf(stderr, "mmap error %p\n", (void*) data);
+      abort();
+    }
+    madvise((void*) data, stat.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  *parser = (struct eggcode_parser) {
+    .filename = filename,
+    .data = data,
+    .end = data + stat.st_size,
+    .cursor = data,
+    .line = 1,
+  };
+
+  const struct eggcode_binary_header *header = (const struct eggcode_binary_header*) data;
+  if ((size_t) stat.st_size < sizeof(*header) || memcmp(header->magic, EGGCODE_BINARY_MAGIC, sizeof(header->magic)) != 0)
+  {
+    return;
+  }
+  if (header->version != EGGCODE_BINARY_VERSION)
+  {
+    fprintf(stderr, "%s is not version %i binary eggcode\n", filename, EGGCODE_BINARY_VERSION);
+    abort();
+  }
+  if ((uint64_t) stat.st_size != sizeof(*header) + header->command_count * sizeof(struct eggcode_binary_record))
+  {
+    fprintf(stderr, "binary eggcode file %s: size does not match command count\n", filename);
+    abort();
+  }
+  parser->record = (const struct eggcode_binary_record*) (header + 1);
+  parser->records_end = parser->record + header->command_count;
+  parser->cursor = parser->end;
+}
+
+void eggcode_open_buffer(struct eggcode_parser *parser, const char *filename, char *buffer, size_t size)
+{
+  *parser = (struct eggcode_parser) {
+    .filename = filename,
+    .data = buffer,
+    .end = buffer + size,
+    .buffer = buffer,
+    .cursor = buffer,
+    .line = 1,
+  };
+}
+
+void eggcode_close(struct eggcode_parser *parser)
+{
+  if (parser->stream && parser->fd != STDIN_FILENO)
+  {
+    close(parser->fd);
+  }
+  if (parser->buffer)
+  {
+    free(parser->buffer);
+  }
+  else if (parser->data)
+  {
+    munmap((void*) parser->data, parser->end - parser->data);
+  }
+  parser->data = parser->end = parser->cursor = NULL;
+  parser->buffer = NULL;
+  parser->record = parser->records_end = NULL;
+  parser->stream = false;
+}
+
+static void eggcode_error(struct eggcode_parser *parser, const struct eggcode_command *command, const char *at, const char *msg)
+{
+  fprintf(
+    stderr, "%s:%i:%i: %s in '%.*s'\n",
+    parser->filename, command->line, (int) (at - command->text) + 1, msg,
+    command->text_len, command->text
+  );
+  abort();
+}
+
+// [-+]?[0-9]+, with leading spaces; returns where the number ended or NULL if there was none
+static const char *scan_int(const char *cursor, const char *end, int *value)
+{
+  while (cursor < end && *cursor == ' ') cursor++;
+
+  bool negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+'))
+  {
+    negative = *cursor == '-';
+    cursor++;
+  }
+
+  const char *digits = cursor;
+  long long result = 0;
+  while (cursor < end && *cursor >= '0' && *cursor <= '9')
+  {
+    result = result * 10 + (*cursor - '0');
+    if (result > INT_MAX) return NULL;
+    cursor++;
+  }
+  if (cursor == digits) return NULL;
+
+  *value = negative ? -result : result;
+  return cursor;
+}
+
+// parse `count` comma-separated integers following the two-letter command name.
+// anything after them is ignored, as EBB commands take optional trailing arguments.
+static void eggcode_args(struct eggcode_parser *parser, struct eggcode_command *command, int count)
+{
+  const char *cursor = command->text + 2;
+  const char *end = command->text + command->text_len;
+  for (int i = 0; i < count; i++)
+  {
+    if (cursor == end || *cursor != ',')
+    {
+      eggcode_error(parser, command, cursor, "expected another argument");
+    }
+    cursor++;
+    const char *next = scan_int(cursor, end, &command->args[i]);
+    if (!next)
+    {
+      eggcode_error(parser, command, cursor, "expected an integer");
+    }
+    cursor = next;
+  }
+}
+
+// the next record of a binary file, which was checked to hold whole records when it was opened
+static bool eggcode_next_record(struct eggcode_parser *parser, struct eggcode_command *command)
+{
+  if (parser->record == parser->records_end) return false;
+
+  const struct eggcode_binary_record *record = parser->record++;
+  *command = (struct eggcode_command) {
+    .kind = record->kind,
+    .args = { record->args[0], record->args[1], record->args[2] },
+    .line = parser->line++,
+  };
+  if (record->kind != EGGCODE_SP && record->kind != EGGCODE_SM)
+  {
+    fprintf(stderr, "%s: record %i: unknown command kind %i\n", parser->filename, command->line, (int) record->kind);
+    abort();
+  }
+  return true;
+}
+
+bool eggcode_next(struct eggcode_parser *parser, struct eggcode_command *command)
+{
+  if (parser->record) return eggcode_next_record(parser, command);
+
+  while (true)
+  {
+    const char *line = parser->cursor;
+    const char *eol = line < parser->end ? memchr(line, '\n', parser->end - line) : NULL;
+    if (!eol && parser->stream && !parser->eof)
+    {
+      // the line isn't all in yet
+      eggcode_fill(parser);
+      continue;
+    }
+    if (line == parser->end) return false;
+    if (!eol) eol = parser->end;
+    parser->cursor = eol < parser->end ? eol + 1 : eol;
+
+    const char *text_end = eol;
+    while (text_end > line && (text_end[-1] == '\r' || text_end[-1] == ' ')) text_end--;
+
+    *command = (struct eggcode_command) {
+      .line = parser->line++,
+      .text = line,
+      .text_len = text_end - line,
+    };
+    if (command->text_len == 0) continue;
+
+    if (command->text_len >= 3 && line[0] == 'S' && line[1] == 'P' && line[2] == ',')
+    {
+      command->kind = EGGCODE_SP;
+      eggcode_args(parser, command, 2);
+    }
+    else if (command->text_len >= 3 && line[0] == 'S' && line[1] == 'M' && line[2] == ',')
+    {
+      command->kind = EGGCODE_SM;
+      eggcode_args(parser, command, 3);
+    }
+    else
+    {
+      command->kind = EGGCODE_UNKNOWN;
+    }
+    return true;
+  }
+}
+
+bool eggcode_probe_binary(const char *filename, struct eggcode_binary_header *header)
+{
+  FILE *file = fopen(filename, "r");
+  if (!file) return false;
+
+  bool res = fread(header, sizeof(*header), 1, file) == 1
+    && memcmp(header->magic, EGGCODE_BINARY_MAGIC, sizeof(header->magic)) == 0;
+  fclose(file);
+  return res;
+}
+
+int eggcode_write_binary(struct eggcode_parser *parser, const char *filename, struct eggcode_binary_header *header)
+{
+  FILE *file = fopen(filename, "w");
+  if (!file)
+  {
+    perror("can't create binary eggcode file: ");
+    abort();
+  }
+  *header = (struct eggcode_binary_header) {
+    .magic = EGGCODE_BINARY_MAGIC,
+    .version = EGGCODE_BINARY_VERSION,
+  };
+  // placeholder, rewritten with the totals at the end
+  if (fwrite(header, sizeof(*header), 1, file) != 1)
+  {
+    perror("can't write binary eggcode header: ");
+    abort();
+  }
+
+  struct eggcode_command command;
+  int skipped = 0, egg = 0, pen = 0;
+  while (eggcode_next(parser, &command))
+  {
+    if (command.kind == EGGCODE_UNKNOWN)
+    {
+      skipped++;
+      continue;
+    }
+    struct eggcode_binary_record record = { command.kind, { command.args[0], command.args[1] } };
+    if (command.kind == EGGCODE_SP)
+    {
+      header->duration_ms += command.args[1];
+    }
+    else
+    {
+      record.args[2] = command.args[2];
+      header->duration_ms += command.args[0];
+      pen += command.args[1];
+      egg += command.args[2];
+      if (egg < header->egg_min) header->egg_min = egg;
+      if (egg > header->egg_max) header->egg_max = egg;
+      if (pen < header->pen_min) header->pen_min = pen;
+      if (pen > header->pen_max) header->pen_max = pen;
+    }
+    if (fwrite(&record, sizeof(record), 1, file) != 1)
+    {
+      perror("can't write binary eggcode record: ");
+      abort();
+    }
+    header->command_count++;
+  }
+
+  if (fseek(file, 0, SEEK_SET) != 0
+    || fwrite(header, sizeof(*header), 1, file) != 1
+    || fclose(file) != 0)
+  {
+    perror("can't finish binary eggcode file: ");
+    abort();
+  }
+  return skipped;
+}
@@ -0,0 +1,90 @@
+#ifndef RASPBERRYEGG_EGGCODE_H
+#define RASPBERRYEGG_EGGCODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// eggcode is one EBB command per line. only SP and SM mean anything to us;
+// their arguments are parsed in place from the mmapped file.
+// stdin (`-`) and pipes can't be mapped; they're streamed through a buffer of EGGCODE_STREAM_BUFFER
+// bytes instead, so a job of any length fits. a streamed command's `text` only lasts until the next one.
+// binary eggcode (-b) is the same SP and SM commands as fixed-size records behind a header that
+// sums the job up. all fields are little-endian, which is what both the pi and x86 are, so the file
+// is mmapped as-is and eggcode_next() just hands the records out.
+
+#define EGGCODE_BINARY_MAGIC "EGGBIN\0\0"
+#define EGGCODE_BINARY_VERSION 1
+
+enum eggcode_kind
+{
+  EGGCODE_SP, // SP,penstate,dt_ms - penstate 0 = down, 1 = up
+  EGGCODE_SM, // SM,dt_ms,dpen,degg
+  EGGCODE_UNKNOWN, // anything else; `text` has the line
+};
+
+struct eggcode_binary_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t command_count;
+  int64_t duration_ms; // of every SP and SM, as written
+  // how far SM moves take the pen, in eggcode steps from where the job starts
+  int32_t egg_min, egg_max;
+  int32_t pen_min, pen_max;
+};
+
+struct eggcode_binary_record
+{
+  int32_t kind; // EGGCODE_SP or EGGCODE_SM
+  int32_t args[3]; // as in eggcode_command; an SP's last one is 0
+};
+
+struct eggcode_command
+{
+  enum eggcode_kind kind;
+  int args[3];
+  int line;
+  const char *text; // the line, not 0-terminated; NULL for binary eggcode
+  int text_len;
+};
+
+struct eggcode_parser
+{
+  const char *filename;
+  const char *data, *end; // the whole file
+  char *buffer; // if set, data is this malloc'd buffer instead of a mapping
+  bool stream; // the buffer holds the part of `fd` read so far, from `data`
+  bool eof; // of the stream
+  int fd;
+  const char *cursor; // start of the next line
+  int line; // of the next line, from 1
+  // if set, the file is binary eggcode and these are its records; `line` counts them
+  const struct eggcode_binary_record *record, *records_end;
+};
+
+// whether `filename` is `-` or something else that has to be streamed, like a named pipe.
+// a stream can only be read once, so nothing should be probed on it
+bool eggcode_is_stream(const char *filename);
+
+// `-` is stdin. aborts if the file can't be read
+void eggcode_open(struct eggcode_parser *parser, const char *filename);
+
+// parse `size` bytes of eggcode in `buffer`, which the parser takes over; `filename` is for errors
+void eggcode_open_buffer(struct eggcode_parser *parser, const char *filename, char *buffer, size_t size);
+
+// parse the next command, skipping blank lines. returns false at the end of the file.
+// aborts with file:line:column on a malformed SP or SM command.
+bool eggcode_next(struct eggcode_parser *parser, struct eggcode_command *command);
+
+void eggcode_close(struct eggcode_parser *parser);
+
+// whether the file is binary eggcode, and if so its header, without reading any further
+bool eggcode_probe_binary(const char *filename, struct eggcode_binary_header *header);
+
+// write the rest of the parser's commands to `filename` as binary eggcode, and fill in `header`.
+// commands other than SP and SM are left out; returns how many
+int eggcode_write_binary(struct eggcode_parser *parser, const char *filename, struct eggcode_binary_header *header);
+
+#endif
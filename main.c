@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -14,229 +15,51 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "calibrate.h"
+#include "coalesce.h"
 #include "config.h"
+#include "daemon.h"
+#include "eggcode.h"
+#include "motion.h"
+#include "optimize.h"
+#include "overlap.h"
 #include "pi.h"
+#include "planner.h"
+#include "prepare.h"
 #include "ringbuffer.h"
+#include "rt.h"
+#include "simulate.h"
+#include "stats.h"
+#include "step.h"
 #include "util.h"
+#include "waveform.h"
 
-struct pwm_config
-{
-  int length_pow2;
-  float factor, lock_factor;
-};
-
-struct stepper_config
-{
-  int out1, out2; // in1, in2 (winding 1)
-  int out3, out4; // in3, in4 (winding 2)
-};
-
-struct servo_config
-{
-  int out;
-  float low, high;
-  float pwm_low, pwm_high;
-  float pwm_length; // in s
-};
-
-struct eggbot_config
-{
-  double cycles_per_s;
-  struct pwm_config pwm_config;
-  struct stepper_config egg_config;
-  struct stepper_config pen_config;
-  struct servo_config servo_config;
-  bool dry_run; // don't move the servo
-};
-
-static double move_accel(double length, double dt, double start_speed)
-{
-  // d(t) = 1/2 a t^2 + v0 t
-  // d(dt) = length = 1/2 a dt^2 + v0 dt
-  // a = 2 length / dt^2 - 2 v0 / dt
-  return 2 * (length / (dt * dt) - start_speed / dt);
-}
-
-static float end_speed(float length, float dt, float start_speed)
-{
-  return move_accel(length, dt, start_speed) * dt + start_speed;
-}
-
-static float blend(float t, float low, float high)
-{
-  return low + (high - low) * t;
-}
-
-static float servo_factor(struct servo_config servo_config, float f)
-{
-  return blend(
-    blend(
-      1.0f - f,
-      servo_config.low, servo_config.high
-    ),
-    servo_config.pwm_low, servo_config.pwm_high
-  );
-}
-
-static pthread_t worker_id;
-static bool worker_abort = false;
-static bool worker_aborted = false;
-
-#ifdef LOG_SERVO_TIMINGS
-static int servolog;
-#endif
-
-// round `value` to closest fraction to `fraction`
-// ie. round_frac(&i, 0.25) means i gets rounded to 0, 0.25, 0.5, 0.75, 1 etc.
-static void round_frac(float* value, float fraction)
-{
-  *value = floorf((*value / fraction) + 0.5) * fraction;
-}
-
-static uint64_t global_cycle_counter = 0;
-
-static void step(struct eggbot_config *config, coordinate from, coordinate to, float dt, bool lock)
-{
-  if (dt < 0)
-  {
-    fprintf(stderr, "Time travel detected!\n");
-    abort();
-  }
-
-  float distance_egg = unit_diff_f(from.egg, to.egg);
-  double egg_accel = move_accel(distance_egg, dt, from.egg_speed);
-  // transform into unit "dist_unit / dt^2"
-  double egg_accel_unit = egg_accel * dt * dt;
-  // transform into unit "dist_unit / dt"
-  double egg_v0_unit = from.egg_speed * dt;
-
-  float distance_pen = unit_diff_f(from.pen, to.pen);
-  double pen_accel = move_accel(distance_pen, dt, from.pen_speed);
-  // transform into unit "dist_unit / dt^2"
-  double pen_accel_unit = pen_accel * dt * dt;
-  // transform into unit "dist_unit / dt"
-  double pen_v0_unit = from.pen_speed * dt;
-
-  int cycles = (int) (dt * config->cycles_per_s);
-  /*printf(
-    "dt %f, degg %f, dpen %f - %i cycles\n",
-    dt, distance_egg, distance_pen, cycles
-  );*/
-
-  volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
-  volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
-  float pwm_factor = lock ? config->pwm_config.lock_factor : config->pwm_config.factor;
-
-  if (lock)
-  {
-    // lock to 90° substeps (more motor force)
-    round_frac(&from.egg.substep, 0.25);
-    round_frac(&from.pen.substep, 0.25);
-    round_frac(&to.egg.substep, 0.25);
-    round_frac(&to.egg.substep, 0.25);
-  }
-
-  const float TWOPI = M_PI * 2.0;
-
-  uint32_t last_bits = 0;
-
-  for (int i = 0; i < cycles && !worker_abort; /* i is incremented by the k loop below */)
-  {
-    if (i % 1024 == 0)
-    {
-      atomic_thread_fence(memory_order_acquire);
-    }
-    double t = (double) i / (double) cycles; // unit "distance"
-    double t_global = secs(); // unit s
-    double egg_angle = from.egg.substep + (egg_accel_unit / 2.0) * t * t + egg_v0_unit * t;
-    double pen_angle = from.pen.substep + (pen_accel_unit / 2.0) * t * t + pen_v0_unit * t;
-    // printf("%f; angle = %f vs %f; %f and v0 %f\n", t, angle - from.egg.substep, distance_egg, accel_unit, v0_unit);
-    float egg_angle_substep = TWOPI * (egg_angle - floor(egg_angle));
-    float pen_angle_substep = TWOPI * (pen_angle - floor(pen_angle));
-
-    float egg_sin = sinf(egg_angle_substep), egg_cos = cosf(egg_angle_substep);
-    float pen_sin = sinf(pen_angle_substep), pen_cos = cosf(pen_angle_substep);
-
-    const float exp = 1.0;
-
-    float egg_winding1 = copysignf(powf(fabsf(egg_sin), exp), egg_sin);
-    float egg_winding2 = copysignf(powf(fabsf(egg_cos), exp), egg_cos);
-
-    float pen_winding1 = copysignf(powf(fabsf(pen_sin), exp), pen_sin);
-    float pen_winding2 = copysignf(powf(fabsf(pen_cos), exp), pen_cos);
-
-    float servo_f = servo_factor(config->servo_config, blend(t, from.servo, to.servo));
-    float pwm_length = config->servo_config.pwm_length;
-    float servo_t = ((t_global / pwm_length) - floor(t_global / pwm_length)) * pwm_length; // in s
-    float servo_lowf = servo_f * pwm_length - servo_t; // in s
-    float servo_highf = pwm_length - servo_t; // in s
-    int servo_to_low = (int)(servo_lowf * config->cycles_per_s);
-    int servo_to_high = (int)(servo_highf * config->cycles_per_s);
-
-    bool egg_out1 = egg_winding1 > 0, egg_out2 = egg_winding1 < 0;
-    bool egg_out3 = egg_winding2 > 0, egg_out4 = egg_winding2 < 0;
-
-    bool pen_out1 = pen_winding1 > 0, pen_out2 = pen_winding1 < 0;
-    bool pen_out3 = pen_winding2 > 0, pen_out4 = pen_winding2 < 0;
-
-    struct pwm_config pwm_config = config->pwm_config;
-    struct stepper_config egg_config = config->egg_config;
-    struct stepper_config pen_config = config->pen_config;
-    struct servo_config servo_config = config->servo_config;
-
-    int pwm_limit_egg_winding1 = (int) (pwm_factor * fabsf(egg_winding1) * pwm_config.length_pow2);
-    int pwm_limit_egg_winding2 = (int) (pwm_factor * fabsf(egg_winding2) * pwm_config.length_pow2);
-
-    int pwm_limit_pen_winding1 = (int) (pwm_factor * fabsf(pen_winding1) * pwm_config.length_pow2);
-    int pwm_limit_pen_winding2 = (int) (pwm_factor * fabsf(pen_winding2) * pwm_config.length_pow2);
-
-    uint32_t bits_egg_winding1 = (egg_out1 << egg_config.out1) | (egg_out2 << egg_config.out2);
-    uint32_t bits_egg_winding2 = (egg_out3 << egg_config.out3) | (egg_out4 << egg_config.out4);
-    uint32_t bits_pen_winding1 = (pen_out1 << pen_config.out1) | (pen_out2 << pen_config.out2);
-    uint32_t bits_pen_winding2 = (pen_out3 << pen_config.out3) | (pen_out4 << pen_config.out4);
-    uint32_t bit_servo = (1 << servo_config.out);
-
-    int pwm_len = min(config->pwm_config.length_pow2, cycles - i);
-    for (int k = 0; k < pwm_len; k++)
-    {
-      uint32_t pwm_egg_winding1 = (k < pwm_limit_egg_winding1) ? bits_egg_winding1 : 0;
-      uint32_t pwm_egg_winding2 = (k < pwm_limit_egg_winding2) ? bits_egg_winding2 : 0;
-      uint32_t pwm_pen_winding1 = (k < pwm_limit_pen_winding1) ? bits_pen_winding1 : 0;
-      uint32_t pwm_pen_winding2 = (k < pwm_limit_pen_winding2) ? bits_pen_winding2 : 0;
-      uint32_t servo_bits = ((k < servo_to_low) ? bit_servo : 0) | ((k >= servo_to_high) ? bit_servo : 0);
-      uint32_t pwm_bits = pwm_egg_winding1 | pwm_egg_winding2 | pwm_pen_winding1 | pwm_pen_winding2;
-      uint32_t bits = pwm_bits | servo_bits;
-
-#ifdef LOG_SERVO_TIMINGS
-      if ((bits & bit_servo) != (last_bits & bit_servo)) dprintf(servolog, "%f\t%i\n", secs(), !!(bits & bit_servo));
-#endif
-
-      uint32_t set =  bits & ~last_bits;
-      uint32_t clr = ~bits &  last_bits;
-
-      *clr_reg = clr;
-      *set_reg = set;
-      last_bits = bits;
-    }
-    i += pwm_len;
-  }
-  global_cycle_counter += cycles;
-}
+static enum gpio_backend gpio_backend = GPIO_BACKEND_DEVMEM;
+static enum pwm_engine pwm_engine = PWM_ENGINE_LOOP;
+static pthread_t worker_ids[MACHINES_MAX];
+static int worker_count = 0;
+static atomic_int workers_aborted = 0;
 
 static void clear_all(int signum)
 {
   printf("clear all...\n");
-  if (worker_id != 0 && worker_id != pthread_self())
+  bool on_worker = false;
+  for (int i = 0; i < worker_count; i++)
+  {
+    on_worker |= pthread_equal(worker_ids[i], pthread_self()) != 0;
+  }
+  if (worker_count > 0)
   {
-    printf(" halting worker thread\n");
-    // cancel worker thread to stop it from writing bits
+    printf(" halting worker threads\n");
+    // cancel worker threads to stop them from writing bits. if we're on one, it won't get to say it stopped
     worker_abort = true;
-    while (!worker_aborted) { nap(1); }
+    while (atomic_load(&workers_aborted) < worker_count - on_worker) { nap(1); }
   }
 
   volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
 
   *clr_reg = gpio_reset_mask;
+  if (gpio_levels) gpio_levels_update(0, gpio_reset_mask);
 
   printf("clear all OK\n");
   signal(signum, SIG_DFL);
@@ -267,31 +90,91 @@ static void initialize_gpios(struct eggbot_config *config)
 struct worker
 {
   struct eggbot_config config;
+  struct eggbot_config hold_config; // for holding still while the queue is empty
   struct task_ring_buffer *queue;
+  struct waveform_writer *compiler; // if set, tasks are compiled into it instead of queued
+  struct simulation *simulation; // if set, tasks are simulated instead of queued
+  struct planner *planner; // if set, SM moves go through lookahead planning
+  struct coalescer *coalescer; // if set, runs of SM moves are merged first
+  struct pen_overlap *overlap; // if set, pen changes overlap with the pen-up travel around them
+  float speed; // SM moves run this much faster than the eggcode says
+  bool optimize; // reorder strokes to cut pen-up travel
+  struct step_clock clock;
+  bool verbose; // report the loop rate now and then
+  struct rt_config rt;
+  struct daemon *daemon; // if set, jobs come from the socket and can be paused
+  struct stats *stats; // if set, the worker keeps its timing stats here
+  int machine; // which one, when driving several (-M); -1 when there's only the one
+  struct preparer *preparer; // if set, the worker writes out the blocks it prepares from `queue`
 };
 
 static void coord_bound(coordinate *coordp)
 {
   float penf = unitf(coordp->pen);
-  int low = -5, high = 5;
+  int low = PEN_LOW, high = PEN_HIGH;
   if (penf < low)
   {
     fprintf(stderr, "warn: attempt to set pen position out of bounds: %f\n", penf);
-    coordp->pen = (unit) { .step = low };
+    coordp->pen = unit_steps(low);
   }
   if (penf > high)
   {
     fprintf(stderr, "warn: attempt to set pen position out of bounds: %f\n", penf);
-    coordp->pen = (unit) { .step = high };
+    coordp->pen = unit_steps(high);
   }
 }
 
-static void queue_task(struct task_ring_buffer *buffer, coordinate from, coordinate to, float dt)
+static void send_task(struct worker *worker, coordinate from, coordinate to, float dt)
 {
   coord_bound(&from);
   coord_bound(&to);
 
-  ringbuffer_queue(buffer, (struct task) { .quit = false, .from = from, .to = to, .dt = dt });
+  if (worker->compiler)
+  {
+    waveform_compile(worker->compiler, from, to, dt);
+    return;
+  }
+  if (worker->simulation)
+  {
+    simulate_task(worker->simulation, from, to, dt);
+    return;
+  }
+  ringbuffer_queue(worker->queue, (struct task) { .quit = false, .from = from, .to = to, .dt = dt });
+}
+
+// the moves the overlap is done with
+static void queue_overlapped(struct worker *worker)
+{
+  struct overlap_move move;
+  while (overlap_pop(worker->overlap, &move))
+  {
+    send_task(worker, move.from, move.to, move.dt);
+  }
+}
+
+static void queue_task(struct worker *worker, coordinate from, coordinate to, float dt)
+{
+  if (worker->overlap)
+  {
+    overlap_push(worker->overlap, from, to, dt);
+    queue_overlapped(worker);
+    return;
+  }
+  send_task(worker, from, to, dt);
+}
+
+// finish the pen change and queue the travel held back for the next one
+static void flush_overlap(struct worker *worker)
+{
+  if (!worker->overlap) return;
+  overlap_flush(worker->overlap);
+  queue_overlapped(worker);
+}
+
+static void queue_waveform(struct task_ring_buffer *buffer, struct waveform *waveform)
+{
+  float dt = (double) waveform->header->total_ticks / waveform->header->ticks_per_s;
+  ringbuffer_queue(buffer, (struct task) { .quit = false, .waveform = waveform, .dt = dt });
 }
 
 static void queue_quit(struct task_ring_buffer *buffer)
@@ -309,52 +192,88 @@ static void set_finishing_speed(coordinate from, coordinate *nextp, float dt)
   nextp->pen_speed = end_speed(distance_pen, dt, from.pen_speed);
 }
 
-static void stepper_advance(struct worker *worker, coordinate *coordp, float dt, float egg, float pen, float servo)
+static void stepper_advance(struct worker *worker, coordinate *coordp, float dt, double egg, double pen, float servo)
 {
   coordinate next = coord_advance(*coordp, egg, pen, servo);
 
-  queue_task(worker->queue, *coordp, next, dt);
+  queue_task(worker, *coordp, next, dt);
   set_finishing_speed(*coordp, &next, dt);
   *coordp = next;
 }
 
+// estimated vs measured loop rate, at most every VERBOSE_INTERVAL s
+static void report_rate(struct worker *worker, double *last_report)
+{
+  double now = secs();
+  if (!worker->verbose || now - *last_report < VERBOSE_INTERVAL) return;
+
+  *last_report = now;
+  printf(
+    "rate: %.0f cycles/s estimated, %.0f measured; %+.3f ms off schedule, %llu re-anchors\n",
+    worker->config.cycles_per_s, worker->clock.measured_cycles_per_s,
+    worker->clock.lag * 1e3, (unsigned long long) worker->clock.reanchors
+  );
+}
+
 static void *worker_task(void *data)
 {
   struct worker *worker = (struct worker*) data;
-  cpu_set_t cpuset;
-
-  CPU_ZERO(&cpuset);
-  CPU_SET(3, &cpuset);
-  int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-  if (res != 0)
-  {
-    fprintf(stderr, "pthread_setaffinity_np() failed: %i, %i\n", res, errno);
-    abort();
-  }
+  rt_enter(&worker->rt);
+  worker_stats = worker->stats;
 
+  // with -P, the worker's tasks come off the preparer
+  struct task_ring_buffer *queue = worker->preparer ? worker->preparer->blocks : worker->queue;
+  struct step_progress progress = { 0 };
   coordinate last = {{ 0 }};
+  double last_report = secs();
   while (!worker_abort)
   {
-    if (ringbuffer_peek(worker->queue))
+    if (ringbuffer_peek(queue) || (worker->preparer && ringbuffer_spin(queue, PREPARE_SPIN)))
     {
-      struct task task = ringbuffer_take(worker->queue);
+      struct task task = ringbuffer_take(queue);
+      stats_queue(ringbuffer_fill(queue));
 
       if (task.quit) break;
 
-      step(&worker->config, task.from, task.to, task.dt, false);
+      if (task.waveform)
+      {
+        volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
+        volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
+        waveform_replay(task.waveform, set_reg, clr_reg, &worker_abort);
+        last = waveform_end(task.waveform, last);
+        waveform_close(task.waveform);
+        // the replay kept its own time
+        worker->clock.running = false;
+        continue;
+      }
+
+      if (task.block)
+      {
+        step_block(&worker->config, &worker->clock, &progress, task.block);
+        last = task.block->at;
+        if (!task.block->last) continue;
+
+        preparer_feedback(worker->preparer, worker->config.cycles_per_s, worker->clock.lag);
+        report_rate(worker, &last_report);
+        continue;
+      }
+
+      step(&worker->config, &worker->clock, task.from, task.to, task.dt, false);
       last = task.to;
+      report_rate(worker, &last_report);
     }
     else
     {
-      fprintf(stderr, "warn: ring buffer underrun, idling\n");
-      while (!ringbuffer_peek(worker->queue) && !worker_abort)
-      {
-        coordinate next = last;
-        step(&worker->config, last, next, 0.1f, true);
-      }
+      fprintf(stderr, "warn: ring buffer underrun, holding\n");
+      double start = secs();
+      hold(&worker->hold_config, last, queue);
+      // the schedule starts over with the next task
+      worker->clock.running = false;
+      progress.held = true;
+      stats_underrun(secs() - start);
     }
   }
-  worker_aborted = true;
+  atomic_fetch_add(&workers_aborted, 1);
   return NULL;
 }
 
@@ -381,73 +300,164 @@ static void set_instant_speed(coordinate *fromp, coordinate to, float dt)
   fromp->pen_speed = penmove / dt;
 }
 
+// commit the oldest planned segment
+static void planner_advance(struct worker *worker, coordinate *pos)
+{
+  struct planner_move moves[3];
+  int count = planner_pop(worker->planner, moves);
+  for (int i = 0; i < count; i++)
+  {
+    pos->egg_speed = moves[i].egg_speed;
+    pos->pen_speed = moves[i].pen_speed;
+    stepper_advance(worker, pos, moves[i].dt, moves[i].egg, moves[i].pen, pos->servo);
+  }
+}
+
+static void plan_move(struct worker *worker, coordinate *pos, double egg, double pen, float dt)
+{
+  if (planner_full(worker->planner))
+  {
+    planner_advance(worker, pos);
+  }
+  planner_push(worker->planner, egg, pen, dt);
+}
+
+// bring the planned moves to a stop
+static void flush_planner(struct worker *worker, coordinate *pos)
+{
+  if (!worker->planner) return;
+
+  while (!planner_empty(worker->planner))
+  {
+    planner_advance(worker, pos);
+  }
+}
+
+// eggcode times are scaled by this
+static const float speedscale = 1.0;
+
+// an SM move, through the planner if there is one
+static void sm_move(struct worker *worker, coordinate *pos, int dt_ms, int dpen, int degg)
+{
+  double eggmove = degg / (double) EGG_STEPS_PER_UNIT;
+  double penmove = dpen / (double) PEN_STEPS_PER_UNIT;
+  float dt = dt_ms * speedscale / worker->speed / 1000.0f;
+  if (worker->planner && (degg != 0 || dpen != 0))
+  {
+    plan_move(worker, pos, eggmove, penmove, dt);
+    return;
+  }
+  flush_planner(worker, pos);
+  coordinate next = coord_advance(*pos, eggmove, penmove, pos->servo);
+  set_instant_speed(pos, next, dt);
+  stepper_advance(worker, pos, dt, eggmove, penmove, pos->servo);
+}
+
+// run the merged move
+static void flush_coalescer(struct worker *worker, coordinate *pos)
+{
+  struct coalescer *coalescer = worker->coalescer;
+  if (coalescer && !coalescer_empty(coalescer))
+  {
+    coalescer_clear(coalescer);
+    sm_move(worker, pos, coalescer->dt_ms, coalescer->dpen, coalescer->degg);
+  }
+}
+
+// run the merged move, and bring the planned moves to a stop after it
+static void flush_moves(struct worker *worker, coordinate *pos)
+{
+  flush_coalescer(worker, pos);
+  flush_planner(worker, pos);
+}
+
+// -O
+static void optimize_file(struct eggcode_parser *parser)
+{
+  struct optimize_stats stats;
+  if (parser->record)
+  {
+    printf("%s is binary eggcode, its strokes stay in the order they were converted in\n", parser->filename);
+  }
+  else if (parser->stream)
+  {
+    printf("%s is streamed, its strokes stay in the order they come in\n", parser->filename);
+  }
+  else if (eggcode_optimize(parser, &stats))
+  {
+    printf(
+      "reordered %i strokes, %i backwards: %.1f s of pen-up travel instead of %.1f s\n",
+      stats.strokes, stats.reversed, stats.travel_after, stats.travel_before
+    );
+  }
+}
+
 static void process_eggcode_file(struct worker *worker, coordinate *pos, const char *filename)
 {
-  const float speedscale = 1.0;
-  FILE *cmd_file = fopen(filename, "r");
-  char *line_ptr = NULL;
-  size_t line_len0 = 0;
-  while (true)
+  struct eggcode_parser parser;
+  struct eggcode_command command;
+  eggcode_open(&parser, filename);
+  if (worker->optimize) optimize_file(&parser);
+  if (worker->overlap) overlap_clear_stats(worker->overlap);
+  while (eggcode_next(&parser, &command))
   {
-    ssize_t res = getline(&line_ptr, &line_len0, cmd_file);
-    if (res == -1)
+    if (worker->daemon && daemon_checkpoint(worker->daemon, command.line))
     {
-      fclose(cmd_file);
-      fprintf(stderr, "cannot read line, file processing complete.\n");
-      break;
+      // the worker holds position while paused, so come to a stop there first
+      flush_moves(worker, pos);
+      flush_overlap(worker);
+      if (!daemon_wait_resume(worker->daemon)) break;
     }
-    size_t line_len = line_len0 - 1;
-
-    if (strncmp(line_ptr, "SP,", min(3, line_len)) == 0)
+    if (worker->simulation)
     {
-      int dt_ms;
-      int penstate; // 0 = down, 1 = up
-      res = sscanf(line_ptr, "SP,%i,%i", &penstate, &dt_ms);
-      if (res != 2)
-      {
-        fprintf(stderr, "invalid SP command %s\n", line_ptr);
-        abort();
-      }
+      worker->simulation->line = command.line;
+    }
+    if (command.kind == EGGCODE_SP)
+    {
+      int penstate = command.args[0]; // 0 = down, 1 = up
+      int dt_ms = command.args[1];
+      flush_moves(worker, pos);
       pos->egg_speed = 0;
       pos->pen_speed = 0;
       stepper_advance(worker, pos, dt_ms * speedscale / 1000.0f, 0.0, 0.0, penstate);
     }
-    else if (strncmp(line_ptr, "SM,", min(3, line_len)) == 0)
+    else if (command.kind == EGGCODE_SM)
     {
-      int dt_ms;
-      int degg;
-      int dpen;
-      res = sscanf(line_ptr, "SM,%i,%i,%i", &dt_ms, &dpen, &degg);
-      if (res != 3)
+      int dt_ms = command.args[0];
+      int dpen = command.args[1];
+      int degg = command.args[2];
+      struct coalescer *coalescer = worker->coalescer;
+      if (coalescer)
       {
-        fprintf(stderr, "invalid SM command %s\n", line_ptr);
-        abort();
+        if (coalescer_push(coalescer, dt_ms, dpen, degg)) continue;
+        // doesn't fit the run so far: run that, and maybe start a new one
+        flush_coalescer(worker, pos);
+        if (coalescer_push(coalescer, dt_ms, dpen, degg)) continue;
       }
-      float eggmove = degg / 64.0f;
-      float penmove = dpen / 90.0f;
-      float dt = dt_ms * speedscale / 1000.0f;
-      coordinate next = coord_advance(*pos, eggmove, penmove, pos->servo);
-      set_instant_speed(pos, next, dt);
-      stepper_advance(worker, pos, dt, eggmove, penmove, pos->servo);
+      sm_move(worker, pos, dt_ms, dpen, degg);
     }
     else
     {
-      printf("# unknown command %s\n", line_ptr);
+      printf("# unknown command %.*s\n", command.text_len, command.text);
     }
   }
+  eggcode_close(&parser);
+  flush_moves(worker, pos);
+  flush_overlap(worker);
+  if (worker->overlap)
+  {
+    struct pen_overlap *overlap = worker->overlap;
+    printf(
+      "overlapped %i pen changes with travel: stood still %.1f s instead of %.1f s, %.1f s saved\n",
+      overlap->changes, overlap->still_s, overlap->change_s, overlap_saved(overlap)
+    );
+  }
+  fprintf(stderr, "end of file, file processing complete.\n");
 }
 
-int main(int argc, const char **argv)
+// pin map, servo and pwm factors from config.h; timing is left to the caller
+static struct eggbot_config base_config()
 {
-#ifdef LOG_SERVO_TIMINGS
-  servolog = creat("/tmp/servolog.txt", 0666);
-#endif
-
-  gpio_port = mmap_bcm_register(GPIO_REGISTER_BASE);
-  setup_guards();
-
-  burn_cpu();
-
   struct servo_config servo_config = {
     .out = SERVO_PIN,
     .low = SERVO_LOW,
@@ -471,40 +481,8 @@ int main(int argc, const char **argv)
     .out4 = STEPPER_PEN_PIN4,
   };
 
-  struct eggbot_config calibrate_config = {
-    .cycles_per_s = CALIBRATION_CYCLES, // and run for "1s"
-    .dry_run = true,
-    .pwm_config = {
-      .length_pow2 = 2048,
-      .factor = 1.0 / 512.0,
-    },
-    .egg_config = egg_config,
-    .pen_config = pen_config,
-    .servo_config = servo_config,
-  };
-
-  initialize_gpios(&calibrate_config);
-
-  coordinate calibrateFrom = {{ 0 }};
-  coordinate calibrateTo = {{ 0 }};
-  double start = secs();
-  printf("calibrate stepper loop...\n");
-  step(&calibrate_config, calibrateFrom, calibrateTo, 1.0, false);
-  double end = secs();
-  printf("calibrate stepper loop OK\n");
-  printf("%f seconds for %i stepper control cycles\n", end - start, CALIBRATION_CYCLES);
-  double cycles_per_s = CALIBRATION_CYCLES / (end - start);
-  double us_per_cycle = ((end - start) * 1000000.0) / CALIBRATION_CYCLES;
-  int cycles_per_pwm = next_pow2((int)(US_PER_PWM / us_per_cycle));
-  printf(
-    "%f us/cycle; %f cycles/s, %i cycles/pwm\n",
-    us_per_cycle, cycles_per_s, cycles_per_pwm
-  );
-
-  struct eggbot_config config = {
-    .cycles_per_s = cycles_per_s,
+  return (struct eggbot_config) {
     .pwm_config = {
-      .length_pow2 = cycles_per_pwm,
       .factor = BASE_PWM_FACTOR,
       .lock_factor = LOCK_PWM_FACTOR,
       // .boost = 16, // TODO per-coil pwm
@@ -513,49 +491,708 @@ int main(int argc, const char **argv)
     .pen_config = pen_config,
     .servo_config = servo_config
   };
+}
 
-  struct worker worker_thread = {
-    .config = config,
-    .queue = ringbuffer_init(16),
-  };
+// -M egg1,egg2,egg3,egg4,pen1,pen2,pen3,pen4,servo[@core]: the gpios of another machine,
+// and optionally the core for its worker (else -1)
+static bool parse_machine(const char *spec, struct eggbot_config *config, int *core)
+{
+  struct stepper_config *egg = &config->egg_config, *pen = &config->pen_config;
+  int length = 0;
+  int fields = sscanf(
+    spec, "%i,%i,%i,%i,%i,%i,%i,%i,%i%n",
+    &egg->out1, &egg->out2, &egg->out3, &egg->out4,
+    &pen->out1, &pen->out2, &pen->out3, &pen->out4,
+    &config->servo_config.out, &length
+  );
+  if (fields != 9) return false;
 
-  printf("start worker\n");
-  pthread_t worker = start_worker(&worker_thread);
-  worker_id = worker; // so the signal handler can cancel it
+  *core = -1;
+  if (spec[length] == '@') return sscanf(spec + length + 1, "%i", core) == 1 && *core >= 0;
+  return spec[length] == 0;
+}
 
+// every machine needs nine gpios of its own
+static bool check_machine_pins(const struct eggbot_config *configs, int count)
+{
+  uint32_t used = 0;
+  for (int i = 0; i < count; i++)
+  {
+    const struct eggbot_config *config = &configs[i];
+    int pins[] = {
+      config->egg_config.out1, config->egg_config.out2, config->egg_config.out3, config->egg_config.out4,
+      config->pen_config.out1, config->pen_config.out2, config->pen_config.out3, config->pen_config.out4,
+      config->servo_config.out,
+    };
+    for (int k = 0; k < 9; k++)
+    {
+      if (pins[k] < 0 || pins[k] > 27)
+      {
+        fprintf(stderr, "machine %i: there's no gpio %i\n", i, pins[k]);
+        return false;
+      }
+    }
+    uint32_t mask = config_pin_mask(config);
+    if (__builtin_popcount(mask) != 9 || (mask & used))
+    {
+      fprintf(stderr, "machine %i: its gpios are used twice\n", i);
+      return false;
+    }
+    used |= mask;
+  }
+  return true;
+}
+
+// `config` at the hold current and pwm rate
+static struct eggbot_config hold_config(struct eggbot_config config, float factor)
+{
+  config.pwm_config.engine = PWM_ENGINE_EDGE;
+  config.pwm_config.length_pow2 = HOLD_PWM_LENGTH;
+  config.pwm_config.lock_factor = factor;
+  config.cycles_per_s = HOLD_PWM_LENGTH / HOLD_PWM_PERIOD;
+  pwm_config_init(&config.pwm_config);
+  return config;
+}
+
+static coordinate origin()
+{
   coordinate origin = {{ 0 }};
   // origin.pen = unit_add(origin.pen, 0.5);
   origin.servo = 1.0; // up
+  return origin;
+}
 
-  coordinate coord = origin;
+// replay a file compiled with -c. it was compiled starting from the origin, so the
+// winding phases only line up if we're at a whole step with the pen up.
+static void process_waveform_file(struct worker *worker, coordinate *pos, const char *filename)
+{
+  struct waveform *waveform = waveform_open(filename);
+  if (waveform->header->pin_mask != config_pin_mask(&worker->config))
+  {
+    fprintf(stderr, "%s was compiled for a different pin map\n", filename);
+    abort();
+  }
+  if (unit_substep(pos->egg) != 0 || unit_substep(pos->pen) != 0 || pos->servo != origin().servo)
+  {
+    fprintf(stderr, "warn: %s starts off the origin phase, expect a jolt\n", filename);
+  }
+  // the worker closes the waveform once it's done, so read the end position first
+  *pos = waveform_end(waveform, *pos);
+  queue_waveform(worker->queue, waveform);
+}
+
+static void print_file(struct worker *worker, coordinate *pos, const char *filename)
+{
+  printf("printing...\n");
+  // probing a stream would eat the start of it
+  if (!eggcode_is_stream(filename) && waveform_probe(filename))
+  {
+    process_waveform_file(worker, pos, filename);
+  }
+  else
+  {
+    process_eggcode_file(worker, pos, filename);
+  }
+  printf("printing OK\n");
+}
+
+// what's in a binary eggcode file, from its header alone
+static void print_binary_header(const char *filename)
+{
+  struct eggcode_binary_header header;
+  if (eggcode_is_stream(filename) || !eggcode_probe_binary(filename, &header)) return;
+
+  printf(
+    "  %llu commands, %.1f s as written, egg %i..%i and pen %i..%i steps from the start\n",
+    (unsigned long long) header.command_count, header.duration_ms / 1000.0,
+    header.egg_min, header.egg_max, header.pen_min, header.pen_max
+  );
+}
+
+// the pen changes of all machines are asked for on the one terminal, one at a time
+static pthread_mutex_t prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+// a job comes in on stdin (`-`), so the pen changes can't be asked for there
+static bool jobs_on_stdin = false;
+
+// raise the pen, then print the files one after the other, prompting for a pen change before each
+static void print_files(struct worker *worker, coordinate *pos, int filec, char **filev)
+{
   // raise servo if it's low
-  stepper_advance(&worker_thread, &coord, 0.5, 0.0, 0.0, 1.0);
+  stepper_advance(worker, pos, 0.5, 0.0, 0.0, 1.0);
 
-  // stepper_advance(&worker_thread, &coord, 2.0, 0.0, -4.0, 1.0);
+  // stepper_advance(worker, pos, 2.0, 0.0, -4.0, 1.0);
 
-  for (int i = 1; i < argc; i++)
+  for (int i = 0; i < filec; i++)
   {
-    printf("next: '%s'\n", argv[i]);
-    wait_for_return("Please insert the next pen and press return to continue.");
-    printf("printing...\n");
-    process_eggcode_file(&worker_thread, &coord, argv[i]);
-    printf("printing OK\n");
+    pthread_mutex_lock(&prompt_lock);
+    if (worker->machine >= 0) printf("machine %i, ", worker->machine);
+    printf("next: '%s'\n", filev[i]);
+    print_binary_header(filev[i]);
+    if (!jobs_on_stdin) wait_for_return("Please insert the next pen and press return to continue.");
+    pthread_mutex_unlock(&prompt_lock);
+    print_file(worker, pos, filev[i]);
     // better use eggbot exporter "always home" feature for this.
     /*printf("homing.\n");
     {
       // approx distance
-      float dist = fabsf(unitf(coord.egg)) + fabsf(unitf(coord.pen));
+      float dist = fabsf(unitf(pos->egg)) + fabsf(unitf(pos->pen));
       float dt = dist / 5.0;
 
-      set_instant_speed(&coord, origin, dt);
-      queue_task(worker_thread.queue, coord, origin, dt);
-      coord = origin;
+      set_instant_speed(pos, origin(), dt);
+      queue_task(worker, *pos, origin(), dt);
+      *pos = origin();
     }*/
   }
+}
+
+// one machine's files, on a thread of their own
+struct machine_jobs
+{
+  struct worker *worker;
+  int filec;
+  char **filev;
+};
+
+static void *machine_jobs_task(void *data)
+{
+  struct machine_jobs *jobs = data;
+  coordinate coord = origin();
+  print_files(jobs->worker, &coord, jobs->filec, jobs->filev);
+  return NULL;
+}
+
+// take jobs from the socket until told to quit
+static void serve(struct worker *worker, coordinate *pos, const char *socket_path)
+{
+  worker->daemon = daemon_start(socket_path);
+  char *job;
+  while ((job = daemon_next_job(worker->daemon)))
+  {
+    printf("next: '%s', waiting for the pen\n", job);
+    if (!daemon_wait_pen(worker->daemon)) break;
+    print_file(worker, pos, job);
+    daemon_job_done(worker->daemon);
+  }
+  daemon_close(worker->daemon);
+}
+
+// compile the eggcode files into one waveform file, as if printed starting from the origin.
+// doesn't touch the gpios, so this runs on any machine.
+static int compile(struct worker worker, const char *output, int filec, char **filev)
+{
+  struct eggbot_config config = base_config();
+  config.pwm_config.length_pow2 = COMPILE_TICKS_PER_PWM;
+  config.cycles_per_s = COMPILE_TICKS_PER_PWM * 1000000.0 / US_PER_PWM;
+  pwm_config_init(&config.pwm_config);
+
+  worker.config = config;
+  worker.compiler = waveform_create(output, config);
+
+  coordinate coord = origin();
+  for (int i = 0; i < filec; i++)
+  {
+    printf("compiling '%s'...\n", filev[i]);
+    process_eggcode_file(&worker, &coord, filev[i]);
+  }
+  waveform_finish(worker.compiler, coord);
+  return 0;
+}
+
+// convert a text eggcode file to binary eggcode, reordering its strokes on the way with -O
+static int convert(struct worker worker, const char *output, int filec, char **filev)
+{
+  if (filec != 1)
+  {
+    fprintf(stderr, "-b converts one file at a time\n");
+    return 1;
+  }
+  struct eggcode_parser parser;
+  eggcode_open(&parser, filev[0]);
+  if (parser.record)
+  {
+    fprintf(stderr, "%s is binary eggcode already\n", filev[0]);
+    eggcode_close(&parser);
+    return 1;
+  }
+  if (worker.optimize) optimize_file(&parser);
+
+  struct eggcode_binary_header header;
+  int skipped = eggcode_write_binary(&parser, output, &header);
+  eggcode_close(&parser);
+  if (skipped > 0)
+  {
+    fprintf(stderr, "warn: left out %i commands other than SP and SM\n", skipped);
+  }
+  printf("converted %llu commands\n", (unsigned long long) header.command_count);
+  print_binary_header(output);
+  return 0;
+}
+
+static struct planner_config planner_config()
+{
+  return (struct planner_config) {
+    .egg_accel = PLANNER_EGG_ACCEL,
+    .pen_accel = PLANNER_PEN_ACCEL,
+    .egg_jump = PLANNER_EGG_JUMP,
+    .pen_jump = PLANNER_PEN_JUMP,
+    .egg_max_speed = PLANNER_EGG_MAX_SPEED,
+    .pen_max_speed = PLANNER_PEN_MAX_SPEED,
+  };
+}
+
+// run the files through the motion math as fast as we can, as if printed starting from the origin,
+// and report how long they take and whether the steppers keep up. doesn't touch the gpios.
+// returns 1 if any move is past what the steppers take.
+static int simulate(struct worker worker, const char *trajectory, int filec, char **filev)
+{
+  struct eggbot_config config = base_config();
+  config.dry_run = true;
+  config.pwm_config.length_pow2 = COMPILE_TICKS_PER_PWM;
+  config.cycles_per_s = COMPILE_TICKS_PER_PWM * 1000000.0 / US_PER_PWM;
+  pwm_config_init(&config.pwm_config);
+
+  struct simulation simulation;
+  simulate_init(&simulation, config, planner_config(), trajectory);
+  worker.config = config;
+  worker.simulation = &simulation;
+
+  double start = secs();
+  coordinate coord = origin();
+  for (int i = 0; i < filec; i++)
+  {
+    simulate_file_start(&simulation, filev[i]);
+    if (!eggcode_is_stream(filev[i]) && waveform_probe(filev[i]))
+    {
+      // the moves are compiled away, only the length is left
+      struct waveform *waveform = waveform_open(filev[i]);
+      coord = waveform_end(waveform, coord);
+      simulate_skip(&simulation, coord, (double) waveform->header->total_ticks / waveform->header->ticks_per_s);
+      waveform_close(waveform);
+    }
+    else
+    {
+      process_eggcode_file(&worker, &coord, filev[i]);
+    }
+    simulate_file_end(&simulation);
+  }
+  return simulate_finish(&simulation, filec, secs() - start) > 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-p] [-O] [-m] [-L clearance] [-v] [-s speed] [-r priority] [-C core] [-e engine] [-H current] [-P] [-q low,high] [-R] [-g backend] [-t trace] [-c output.wave] file...\n", name);
+  fprintf(stderr, "       %s -M pins [-M pins...] [options] file... N:file...\n", name);
+  fprintf(stderr, "       %s -b output.eggbin [-O] file\n", name);
+  fprintf(stderr, "       %s -n [-T trajectory] [-p] [-O] [-m] [-L clearance] [-s speed] file...\n", name);
+  fprintf(stderr, "       %s -d socket [options]\n", name);
+  fprintf(stderr, "       %s -j socket print file | pen | pause | resume | status | quit\n", name);
+  fprintf(stderr, "       %s -S\n", name);
+  fprintf(stderr, "  -p        plan SM moves ahead with acceleration limits\n");
+  fprintf(stderr, "  -O        reorder strokes to cut pen-up travel\n");
+  fprintf(stderr, "  -m        merge runs of SM moves that make up a nearly straight line\n");
+  fprintf(stderr, "  -L clear  overlap pen changes with travel; the pen is clear of the egg past this fraction of the servo's travel\n");
+  fprintf(stderr, "  -s speed  run SM moves this much faster\n");
+  fprintf(stderr, "  -v        report the estimated and measured loop rate while printing\n");
+  fprintf(stderr, "  -r prio   real-time mode: run the worker on SCHED_FIFO at this priority, with memory locked\n");
+  fprintf(stderr, "  -C core   run the worker on this cpu; by default an isolated one, or the last\n");
+  fprintf(stderr, "  -e edge   write the gpios only when a pin changes, timed by the cycle counter\n");
+  fprintf(stderr, "  -H factor hold still at this fraction of full current while there's nothing to do\n");
+  fprintf(stderr, "  -P        prepare the worker's gpio writes on another thread, so it only has to write them out\n");
+  fprintf(stderr, "  -q lo,hi  queue up to hi s of moves for the worker, then wait until it's down to lo\n");
+  fprintf(stderr, "  -R        recalibrate even if the cached calibration still fits\n");
+  fprintf(stderr, "  -g memory drive a page of memory instead of the gpio registers\n");
+  fprintf(stderr, "  -t file   record every gpio change and save it to file\n");
+  fprintf(stderr, "  -c file   compile the eggcode files into a waveform file\n");
+  fprintf(stderr, "  -b file   convert the eggcode file into binary eggcode, which loads without parsing\n");
+  fprintf(stderr, "  -n        simulate the files: print how long they take and flag moves the steppers can't follow\n");
+  fprintf(stderr, "  -T file   simulate, and save the egg, pen and servo position every %g s to file\n", SIMULATE_SAMPLE_PERIOD);
+  fprintf(stderr, "  -d socket run as a daemon, taking jobs on this unix socket instead of the command line\n");
+  fprintf(stderr, "  -j socket send a command to the daemon on this socket\n");
+  fprintf(stderr, "  -S        show the timing stats of the running driver\n");
+  fprintf(stderr, "  -M egg1,egg2,egg3,egg4,pen1,pen2,pen3,pen4,servo[@core]\n");
+  fprintf(stderr, "            drive another machine on these gpios, with its worker on this cpu. machines are numbered\n");
+  fprintf(stderr, "            from 0, the one in config.h; N:file prints the file on machine N, plain files go to 0\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char *compile_output = NULL;
+  const char *binary_output = NULL;
+  const char *trace_output = NULL;
+  bool simulation = false;
+  const char *trajectory_output = NULL;
+  float hold_factor = HOLD_PWM_FACTOR;
+  double low_water = QUEUE_LOW_WATER, high_water = QUEUE_HIGH_WATER;
+  bool use_calibration_cache = true;
+  bool prepare_frames = false;
+  const char *daemon_socket = NULL, *client_socket = NULL;
+  struct planner planner;
+  struct coalescer coalescer;
+  struct pen_overlap overlap;
+  // machine 0 is the one in config.h, -M adds more
+  struct eggbot_config machine_pins[MACHINES_MAX] = { base_config() };
+  int machine_cores[MACHINES_MAX] = { -1 };
+  int machine_count = 1;
+  // job settings; config, queue etc. are filled in once we know the mode
+  struct worker worker_thread = {
+    .speed = 1.0,
+    .rt = { .core = -1 },
+  };
 
-  queue_quit(worker_thread.queue);
-  pthread_join(worker, NULL);
-  worker_id = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:c:C:d:e:g:H:j:L:mM:nOpPq:r:Rs:St:T:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'S':
+        return stats_show();
+      case 'g':
+        if (strcmp(optarg, "devmem") == 0) gpio_backend = GPIO_BACKEND_DEVMEM;
+        else if (strcmp(optarg, "memory") == 0) gpio_backend = GPIO_BACKEND_MEMORY;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'e':
+        if (strcmp(optarg, "loop") == 0) pwm_engine = PWM_ENGINE_LOOP;
+        else if (strcmp(optarg, "edge") == 0) pwm_engine = PWM_ENGINE_EDGE;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'H':
+        hold_factor = atof(optarg);
+        if (hold_factor < 0 || hold_factor > 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'q':
+        if (sscanf(optarg, "%lf,%lf", &low_water, &high_water) != 2 || low_water < 0 || low_water >= high_water)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'd':
+        daemon_socket = optarg;
+        break;
+      case 'j':
+        client_socket = optarg;
+        break;
+      case 'R':
+        use_calibration_cache = false;
+        break;
+      case 't':
+        trace_output = optarg;
+        break;
+      case 'n':
+        simulation = true;
+        break;
+      case 'T':
+        simulation = true;
+        trajectory_output = optarg;
+        break;
+      case 'v':
+        worker_thread.verbose = true;
+        break;
+      case 'r':
+        worker_thread.rt.enabled = true;
+        worker_thread.rt.priority = atoi(optarg);
+        if (worker_thread.rt.priority < 1 || worker_thread.rt.priority > 99)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'C':
+        worker_thread.rt.core = atoi(optarg);
+        if (worker_thread.rt.core < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'b':
+        binary_output = optarg;
+        break;
+      case 'c':
+        compile_output = optarg;
+        break;
+      case 'm':
+        coalescer_clear(&coalescer);
+        worker_thread.coalescer = &coalescer;
+        break;
+      case 'O':
+        worker_thread.optimize = true;
+        break;
+      case 'L':
+      {
+        float clearance = atof(optarg);
+        if (clearance <= 0 || clearance >= 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        overlap_init(&overlap, machine_pins[0].servo_config, clearance);
+        worker_thread.overlap = &overlap;
+        break;
+      }
+      case 'M':
+        if (machine_count == MACHINES_MAX)
+        {
+          fprintf(stderr, "at most %i machines\n", MACHINES_MAX);
+          return 1;
+        }
+        machine_pins[machine_count] = base_config();
+        if (!parse_machine(optarg, &machine_pins[machine_count], &machine_cores[machine_count]))
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        machine_count++;
+        break;
+      case 'p':
+        planner_init(&planner, planner_config());
+        worker_thread.planner = &planner;
+        break;
+      case 'P':
+        prepare_frames = true;
+        break;
+      case 's':
+        worker_thread.speed = atof(optarg);
+        if (worker_thread.speed <= 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (client_socket)
+  {
+    if (optind == argc)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    return daemon_client(client_socket, argc - optind, argv + optind);
+  }
+
+  if (binary_output)
+  {
+    return convert(worker_thread, binary_output, argc - optind, argv + optind);
+  }
+
+  if (machine_count > 1 && (compile_output || simulation || daemon_socket))
+  {
+    fprintf(stderr, "-M only works when printing files given on the command line\n");
+    return 1;
+  }
+  if (prepare_frames && pwm_engine == PWM_ENGINE_EDGE)
+  {
+    fprintf(stderr, "-P prepares frames for the loop engine; the edge engine works its frames out as it goes\n");
+    return 1;
+  }
+  if (prepare_frames && sysconf(_SC_NPROCESSORS_ONLN) == 1)
+  {
+    fprintf(stderr, "warn: only one cpu, the preparer only gets to run while the worker underruns\n");
+  }
+  if (!check_machine_pins(machine_pins, machine_count))
+  {
+    return 1;
+  }
+
+  if (compile_output)
+  {
+    return compile(worker_thread, compile_output, argc - optind, argv + optind);
+  }
+
+  if (simulation)
+  {
+    return simulate(worker_thread, trajectory_output, argc - optind, argv + optind);
+  }
+
+#ifdef LOG_SERVO_TIMINGS
+  servolog = creat("/tmp/servolog.txt", 0666);
+#endif
+
+  gpio_port = gpio_backend == GPIO_BACKEND_DEVMEM
+    ? mmap_bcm_register(GPIO_REGISTER_BASE)
+    : memory_register_page();
+  setup_guards();
+
+  struct eggbot_config calibrate_config = base_config();
+  calibrate_config.dry_run = true;
+  calibrate_config.pwm_config = (struct pwm_config) {
+    .length_pow2 = 2048,
+    .factor = 1.0 / 512.0,
+  };
+  pwm_config_init(&calibrate_config.pwm_config);
+
+  for (int i = 0; i < machine_count; i++)
+  {
+    initialize_gpios(&machine_pins[i]);
+  }
+
+  struct calibration calibration = calibrate(
+    &calibrate_config, gpio_backend, rt_pick_core(&worker_thread.rt), CALIBRATION_CACHE, use_calibration_cache
+  );
+
+  struct eggbot_config config = base_config();
+  config.cycles_per_s = calibration.cycles_per_s;
+  config.pwm_config.length_pow2 = calibration.cycles_per_pwm;
+  if (pwm_engine == PWM_ENGINE_EDGE)
+  {
+    // no loop to time: the frame is split into as many cycles as the counter can tell apart
+    double ticks_per_pwm = cycle_counter_hz() * US_PER_PWM / 1000000.0;
+    int length = next_pow2((int) ticks_per_pwm + 1) / 2;
+    config.pwm_config.length_pow2 = length < EDGE_PWM_LENGTH_MAX ? length : EDGE_PWM_LENGTH_MAX;
+    config.cycles_per_s = config.pwm_config.length_pow2 * 1000000.0 / US_PER_PWM;
+    printf(
+      "edge engine: %.0f counter ticks/s, %i cycles/pwm, %f cycles/s\n",
+      cycle_counter_hz(), config.pwm_config.length_pow2, config.cycles_per_s
+    );
+  }
+  config.pwm_config.engine = pwm_engine;
+  pwm_config_init(&config.pwm_config);
+
+  if (trace_output)
+  {
+    trace_start(TRACE_CAPACITY);
+  }
+  struct stats *stats = stats_create(config.cycles_per_s, config.pwm_config.length_pow2 / config.cycles_per_s);
+
+  // every machine gets its own pins, queue, planner and worker, each worker on a core of its own
+  struct worker workers[MACHINES_MAX];
+  struct planner planners[MACHINES_MAX];
+  struct coalescer coalescers[MACHINES_MAX];
+  struct pen_overlap overlaps[MACHINES_MAX];
+  pthread_t preparers[MACHINES_MAX];
+  int first_core = rt_pick_core(&worker_thread.rt);
+  for (int i = 0; i < machine_count; i++)
+  {
+    struct worker *worker = &workers[i];
+    *worker = worker_thread;
+    worker->machine = machine_count > 1 ? i : -1;
+    worker->config = config;
+    worker->config.egg_config = machine_pins[i].egg_config;
+    worker->config.pen_config = machine_pins[i].pen_config;
+    worker->config.servo_config.out = machine_pins[i].servo_config.out;
+    worker->hold_config = hold_config(worker->config, hold_factor);
+    worker->queue = ringbuffer_init(QUEUE_SLOTS, low_water, high_water);
+    if (prepare_frames)
+    {
+      // wherever the scheduler finds room, away from the worker
+      worker->preparer = preparer_create(&worker->config, worker->queue);
+      pthread_create(&preparers[i], NULL, preparer_task, worker->preparer);
+    }
+    if (worker_thread.planner)
+    {
+      planners[i] = *worker_thread.planner;
+      worker->planner = &planners[i];
+    }
+    if (worker_thread.coalescer)
+    {
+      coalescers[i] = *worker_thread.coalescer;
+      worker->coalescer = &coalescers[i];
+    }
+    if (worker_thread.overlap)
+    {
+      overlaps[i] = *worker_thread.overlap;
+      worker->overlap = &overlaps[i];
+    }
+    // stats follow the first machine
+    worker->stats = i == 0 ? stats : NULL;
+    // no spare cores on the build server
+    worker->rt.pin_required = gpio_backend == GPIO_BACKEND_DEVMEM;
+    worker->rt.core = machine_cores[i] >= 0 ? machine_cores[i] : first_core - i > 0 ? first_core - i : 0;
+
+    if (worker->machine >= 0) printf("machine %i, ", i);
+    printf("start worker on cpu %i\n", worker->rt.core);
+    // so the signal handler can cancel it
+    worker_ids[worker_count] = start_worker(worker);
+    worker_count++;
+  }
+
+  // files go to machine 0, or as N:file to machine N
+  char **machine_files[MACHINES_MAX];
+  int machine_filec[MACHINES_MAX] = { 0 };
+  for (int i = 0; i < machine_count; i++)
+  {
+    machine_files[i] = malloc(sizeof(char*) * argc);
+  }
+  for (int i = optind; i < argc; i++)
+  {
+    char *file = argv[i], *end;
+    long machine = strtol(file, &end, 10);
+    if (machine_count == 1 || !isdigit((unsigned char) file[0]) || *end != ':' || machine >= machine_count)
+    {
+      machine = 0;
+    }
+    else
+    {
+      file = end + 1;
+    }
+    machine_files[machine][machine_filec[machine]++] = file;
+    jobs_on_stdin |= strcmp(file, "-") == 0;
+  }
+
+  if (machine_count == 1)
+  {
+    coordinate coord = origin();
+    print_files(&workers[0], &coord, machine_filec[0], machine_files[0]);
+    if (daemon_socket)
+    {
+      serve(&workers[0], &coord, daemon_socket);
+    }
+  }
+  else
+  {
+    pthread_t producers[MACHINES_MAX];
+    struct machine_jobs jobs[MACHINES_MAX];
+    for (int i = 0; i < machine_count; i++)
+    {
+      jobs[i] = (struct machine_jobs) { &workers[i], machine_filec[i], machine_files[i] };
+      pthread_create(&producers[i], NULL, machine_jobs_task, &jobs[i]);
+    }
+    for (int i = 0; i < machine_count; i++)
+    {
+      pthread_join(producers[i], NULL);
+    }
+  }
+
+  for (int i = 0; i < machine_count; i++)
+  {
+    queue_quit(workers[i].queue);
+  }
+  for (int i = 0; i < machine_count; i++)
+  {
+    pthread_join(worker_ids[i], NULL);
+    if (workers[i].preparer) pthread_join(preparers[i], NULL);
+    free(machine_files[i]);
+  }
+  worker_count = 0;
+  if (trace_output)
+  {
+    trace_save(trace_output);
+    trace_summary(stdout);
+    for (int i = 0; i < machine_count; i++)
+    {
+      if (workers[i].machine >= 0) printf("machine %i, ", i);
+      trace_report(stdout, config_pin_mask(&workers[i].config), workers[i].config.servo_config.out);
+    }
+  }
+  stats_close();
   clear_all(0);
   return 0;
 }
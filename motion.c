@@ -0,0 +1,16 @@
+#include "motion.h"
+
+static void fill_duty_table(uint16_t *duty, float factor, int length_pow2)
+{
+  for (int i = 0; i <= SINE_TABLE_SIZE; i++)
+  {
+    float winding = sinf((float) M_PI / 2.0f * i / SINE_TABLE_SIZE);
+    duty[i] = (uint16_t) (factor * winding * length_pow2);
+  }
+}
+
+void pwm_config_init(struct pwm_config *pwm_config)
+{
+  fill_duty_table(pwm_config->duty, pwm_config->factor, pwm_config->length_pow2);
+  fill_duty_table(pwm_config->lock_duty, pwm_config->lock_factor, pwm_config->length_pow2);
+}
@@ -0,0 +1,279 @@
+#ifndef RASPBERRYEGG_MOTION_H
+#define RASPBERRYEGG_MOTION_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util.h"
+
+// quarter-wave resolution of the winding duty tables
+#define SINE_TABLE_BITS 10
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+
+enum pwm_engine
+{
+  PWM_ENGINE_LOOP, // write the registers every cycle; a cycle is one trip round the loop
+  PWM_ENGINE_EDGE, // write them only at the frame's edges; a cycle is a fixed slice of the frame, timed by cycle_counter()
+};
+
+struct pwm_config
+{
+  enum pwm_engine engine;
+  int length_pow2;
+  float factor, lock_factor;
+  // on-cycles of a winding over the first quarter of a step, at factor and lock_factor.
+  // filled in by pwm_config_init().
+  uint16_t duty[SINE_TABLE_SIZE + 1], lock_duty[SINE_TABLE_SIZE + 1];
+};
+
+struct stepper_config
+{
+  int out1, out2; // in1, in2 (winding 1)
+  int out3, out4; // in3, in4 (winding 2)
+};
+
+struct servo_config
+{
+  int out;
+  float low, high;
+  float pwm_low, pwm_high;
+  float pwm_length; // in s
+};
+
+struct eggbot_config
+{
+  double cycles_per_s;
+  struct pwm_config pwm_config;
+  struct stepper_config egg_config;
+  struct stepper_config pen_config;
+  struct servo_config servo_config;
+  bool dry_run; // don't move the servo
+};
+
+static inline double move_accel(double length, double dt, double start_speed)
+{
+  // d(t) = 1/2 a t^2 + v0 t
+  // d(dt) = length = 1/2 a dt^2 + v0 dt
+  // a = 2 length / dt^2 - 2 v0 / dt
+  return 2 * (length / (dt * dt) - start_speed / dt);
+}
+
+static inline float end_speed(float length, float dt, float start_speed)
+{
+  return move_accel(length, dt, start_speed) * dt + start_speed;
+}
+
+static inline float blend(float t, float low, float high)
+{
+  return low + (high - low) * t;
+}
+
+static inline float servo_factor(struct servo_config servo_config, float f)
+{
+  return blend(
+    blend(
+      1.0f - f,
+      servo_config.low, servo_config.high
+    ),
+    servo_config.pwm_low, servo_config.pwm_high
+  );
+}
+
+// call whenever length_pow2 or the factors change
+void pwm_config_init(struct pwm_config *pwm_config);
+
+// winding phases are fixed point with 2^64 being one full step, so they wrap for free.
+static inline uint64_t phase_fixed(double steps)
+{
+  double frac = steps - floor(steps);
+  double fixed = frac * 18446744073709551616.0;
+  // frac just below 1 can round up to 2^64
+  return fixed < 18446744073709551616.0 ? (uint64_t) fixed : 0;
+}
+
+// everything about a move from one coordinate to the next that stays fixed across its pwm frames,
+// plus the per-frame phase accumulators
+struct motion
+{
+  int cycles;
+  const uint16_t *duty;
+  float from_servo, to_servo;
+
+  // phase advances by velocity every frame, velocity by accel
+  uint64_t egg_phase, egg_velocity, egg_accel;
+  uint64_t pen_phase, pen_velocity, pen_accel;
+};
+
+// one pwm frame: each winding's bits stay on while k < pwm_limit,
+// the servo bit is on while k < servo_to_low or k >= servo_to_high
+struct frame
+{
+  int pwm_limit_egg_winding1, pwm_limit_egg_winding2;
+  int pwm_limit_pen_winding1, pwm_limit_pen_winding2;
+  uint32_t bits_egg_winding1, bits_egg_winding2;
+  uint32_t bits_pen_winding1, bits_pen_winding2;
+  uint32_t bit_servo;
+  int servo_to_low, servo_to_high;
+};
+
+// run the move over `cycles` loop cycles; normally dt * cycles_per_s, but step() stretches or
+// squeezes it to meet its deadline
+static inline void motion_init(struct motion *motion, struct eggbot_config *config, coordinate from, coordinate to, float dt, int cycles, bool lock)
+{
+  double distance_egg = unit_diff_f(from.egg, to.egg);
+  double egg_accel = move_accel(distance_egg, dt, from.egg_speed);
+
+  double distance_pen = unit_diff_f(from.pen, to.pen);
+  double pen_accel = move_accel(distance_pen, dt, from.pen_speed);
+
+  if (lock)
+  {
+    // lock to 90° substeps (more motor force)
+    from.egg = unit_round_quarter(from.egg);
+    from.pen = unit_round_quarter(from.pen);
+  }
+
+  // angle(t) = substep + accel/2 t^2 + v0 t, with t in frames:
+  // angle(n + 1) - angle(n) = accel/2 h^2 (2n + 1) + v0 h
+  double h = cycles ? dt * config->pwm_config.length_pow2 / cycles : 0; // s per frame
+
+  *motion = (struct motion) {
+    .cycles = cycles,
+    .duty = lock ? config->pwm_config.lock_duty : config->pwm_config.duty,
+    .from_servo = from.servo,
+    .to_servo = to.servo,
+    .egg_phase = unit_phase(from.egg),
+    .egg_velocity = phase_fixed(egg_accel / 2.0 * h * h + from.egg_speed * h),
+    .egg_accel = phase_fixed(egg_accel * h * h),
+    .pen_phase = unit_phase(from.pen),
+    .pen_velocity = phase_fixed(pen_accel / 2.0 * h * h + from.pen_speed * h),
+    .pen_accel = phase_fixed(pen_accel * h * h),
+  };
+}
+
+// on-cycles of a winding at `phase`; the top two bits pick the quarter wave
+static inline int winding_duty(const uint16_t *duty, uint64_t phase)
+{
+  uint32_t index = (phase >> (62 - SINE_TABLE_BITS)) & (SINE_TABLE_SIZE - 1);
+  return duty[(phase & (1ull << 62)) ? SINE_TABLE_SIZE - index : index];
+}
+
+// sine is negative over the second half of the step
+static inline bool winding_reverse(uint64_t phase)
+{
+  return phase >> 63;
+}
+
+// compute the frame starting at cycle `i` of the move and advance to the next one.
+// frames must be requested in order; `t_global` is the time in s, for the servo pwm
+static inline void motion_frame(struct motion *motion, const struct eggbot_config *config, int i, double t_global, struct frame *frame)
+{
+  const uint64_t QUARTER = 1ull << 62;
+
+  double t = (double) i / (double) motion->cycles; // unit "distance"
+
+  float servo_f = servo_factor(config->servo_config, blend(t, motion->from_servo, motion->to_servo));
+  float pwm_length = config->servo_config.pwm_length;
+  float servo_t = ((t_global / pwm_length) - floor(t_global / pwm_length)) * pwm_length; // in s
+  float servo_lowf = servo_f * pwm_length - servo_t; // in s
+  float servo_highf = pwm_length - servo_t; // in s
+
+  // winding 1 follows sin(phase), winding 2 cos(phase) = sin(phase + 1/4)
+  uint64_t egg_phase1 = motion->egg_phase, egg_phase2 = motion->egg_phase + QUARTER;
+  uint64_t pen_phase1 = motion->pen_phase, pen_phase2 = motion->pen_phase + QUARTER;
+
+  bool egg_out1 = !winding_reverse(egg_phase1), egg_out2 = winding_reverse(egg_phase1);
+  bool egg_out3 = !winding_reverse(egg_phase2), egg_out4 = winding_reverse(egg_phase2);
+
+  bool pen_out1 = !winding_reverse(pen_phase1), pen_out2 = winding_reverse(pen_phase1);
+  bool pen_out3 = !winding_reverse(pen_phase2), pen_out4 = winding_reverse(pen_phase2);
+
+  const struct stepper_config *egg_config = &config->egg_config;
+  const struct stepper_config *pen_config = &config->pen_config;
+
+  *frame = (struct frame) {
+    .pwm_limit_egg_winding1 = winding_duty(motion->duty, egg_phase1),
+    .pwm_limit_egg_winding2 = winding_duty(motion->duty, egg_phase2),
+    .pwm_limit_pen_winding1 = winding_duty(motion->duty, pen_phase1),
+    .pwm_limit_pen_winding2 = winding_duty(motion->duty, pen_phase2),
+    .bits_egg_winding1 = (egg_out1 << egg_config->out1) | (egg_out2 << egg_config->out2),
+    .bits_egg_winding2 = (egg_out3 << egg_config->out3) | (egg_out4 << egg_config->out4),
+    .bits_pen_winding1 = (pen_out1 << pen_config->out1) | (pen_out2 << pen_config->out2),
+    .bits_pen_winding2 = (pen_out3 << pen_config->out3) | (pen_out4 << pen_config->out4),
+    .bit_servo = config->dry_run ? 0 : (1 << config->servo_config.out),
+    .servo_to_low = (int)(servo_lowf * config->cycles_per_s),
+    .servo_to_high = (int)(servo_highf * config->cycles_per_s),
+  };
+
+  motion->egg_phase += motion->egg_velocity;
+  motion->egg_velocity += motion->egg_accel;
+  motion->pen_phase += motion->pen_velocity;
+  motion->pen_velocity += motion->pen_accel;
+}
+
+// gpio levels at cycle `k` of the frame
+static inline uint32_t frame_bits(const struct frame *frame, int k)
+{
+  uint32_t pwm_egg_winding1 = (k < frame->pwm_limit_egg_winding1) ? frame->bits_egg_winding1 : 0;
+  uint32_t pwm_egg_winding2 = (k < frame->pwm_limit_egg_winding2) ? frame->bits_egg_winding2 : 0;
+  uint32_t pwm_pen_winding1 = (k < frame->pwm_limit_pen_winding1) ? frame->bits_pen_winding1 : 0;
+  uint32_t pwm_pen_winding2 = (k < frame->pwm_limit_pen_winding2) ? frame->bits_pen_winding2 : 0;
+  uint32_t servo_bits = ((k < frame->servo_to_low) ? frame->bit_servo : 0) | ((k >= frame->servo_to_high) ? frame->bit_servo : 0);
+  uint32_t pwm_bits = pwm_egg_winding1 | pwm_egg_winding2 | pwm_pen_winding1 | pwm_pen_winding2;
+  return pwm_bits | servo_bits;
+}
+
+// most edges a frame has: its start, four winding duty ends, the servo going low and high
+#define FRAME_MAX_EDGES 7
+
+// a gpio write at cycle `k` of the frame
+struct edge
+{
+  int k;
+  uint32_t set, clr;
+};
+
+// the writes frame_bits() calls for over the first `length` cycles of the frame, in order.
+// the first, at k = 0, is absolute: it puts every pin in `pin_mask` at its level.
+static inline int frame_edges(const struct frame *frame, int length, uint32_t pin_mask, struct edge *edges)
+{
+  int at[FRAME_MAX_EDGES - 1] = {
+    frame->pwm_limit_egg_winding1, frame->pwm_limit_egg_winding2,
+    frame->pwm_limit_pen_winding1, frame->pwm_limit_pen_winding2,
+    frame->servo_to_low, frame->servo_to_high,
+  };
+  for (int i = 1; i < FRAME_MAX_EDGES - 1; i++)
+  {
+    int k = at[i], j = i;
+    for (; j > 0 && at[j - 1] > k; j--) at[j] = at[j - 1];
+    at[j] = k;
+  }
+
+  uint32_t bits = frame_bits(frame, 0);
+  edges[0] = (struct edge) { .k = 0, .set = bits, .clr = pin_mask & ~bits };
+  int count = 1;
+  for (int i = 0; i < FRAME_MAX_EDGES - 1; i++)
+  {
+    if (at[i] <= 0 || at[i] >= length) continue;
+
+    uint32_t next = frame_bits(frame, at[i]);
+    if (next == bits) continue;
+
+    edges[count++] = (struct edge) { .k = at[i], .set = next & ~bits, .clr = ~next & bits };
+    bits = next;
+  }
+  return count;
+}
+
+// every gpio the config drives
+static inline uint32_t config_pin_mask(const struct eggbot_config *config)
+{
+  return (1u << config->servo_config.out)
+    | (1u << config->egg_config.out1) | (1u << config->egg_config.out2)
+    | (1u << config->egg_config.out3) | (1u << config->egg_config.out4)
+    | (1u << config->pen_config.out1) | (1u << config->pen_config.out2)
+    | (1u << config->pen_config.out3) | (1u << config->pen_config.out4);
+}
+
+#endif
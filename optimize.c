@@ -0,0 +1,534 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "optimize.h"
+
+struct stroke
+{
+  const char *text, *end; // its lines, from the pen-down SP to the pen-up SP
+  int egg[2], pen[2]; // where it starts and ends, in eggcode steps from the start of the file
+  bool reversible; // nothing but SMs between the two SPs
+};
+
+// a command that's neither part of a stroke nor a pen-up move; kept in place as far as possible
+struct loose
+{
+  const char *text;
+  int text_len;
+  size_t strokes_before;
+};
+
+struct strokes
+{
+  struct stroke *strokes;
+  size_t count, capacity;
+  struct loose *loose;
+  size_t loose_count, loose_capacity;
+  int end_egg, end_pen; // where the file leaves the pen
+  double egg_speed, pen_speed; // fastest pen-up travel, in eggcode steps/s
+  double travel; // s of pen-up travel
+};
+
+static void *grow(void *array, size_t *capacity, size_t count, size_t size)
+{
+  if (count < *capacity) return array;
+  *capacity = *capacity ? *capacity * 2 : 64;
+  array = realloc(array, *capacity * size);
+  if (!array)
+  {
+    fprintf(stderr, "out of memory\n");
+    abort();
+  }
+  return array;
+}
+
+// returns false if the file ends with the pen down
+static bool cut_strokes(struct eggcode_parser *parser, struct strokes *file)
+{
+  struct eggcode_command command;
+  struct stroke stroke;
+  int egg = 0, pen = 0;
+  bool down = false;
+  while (eggcode_next(parser, &command))
+  {
+    if (command.kind == EGGCODE_SP && !down && command.args[0] == 0)
+    {
+      down = true;
+      stroke = (struct stroke) { .text = command.text, .egg = { egg }, .pen = { pen }, .reversible = true };
+    }
+    else if (command.kind == EGGCODE_SP && down && command.args[0] != 0)
+    {
+      down = false;
+      stroke.end = parser->cursor; // past the newline
+      stroke.egg[1] = egg;
+      stroke.pen[1] = pen;
+      file->strokes = grow(file->strokes, &file->capacity, file->count, sizeof(struct stroke));
+      file->strokes[file->count++] = stroke;
+    }
+    else if (command.kind == EGGCODE_SM)
+    {
+      egg += command.args[2];
+      pen += command.args[1];
+      if (!down)
+      {
+        double dt = command.args[0] / 1000.0;
+        file->travel += dt;
+        if (dt > 0)
+        {
+          file->egg_speed = fmax(file->egg_speed, abs(command.args[2]) / dt);
+          file->pen_speed = fmax(file->pen_speed, abs(command.args[1]) / dt);
+        }
+      }
+    }
+    else if (down)
+    {
+      stroke.reversible = false;
+    }
+    else if (command.kind == EGGCODE_UNKNOWN)
+    {
+      file->loose = grow(file->loose, &file->loose_capacity, file->loose_count, sizeof(struct loose));
+      file->loose[file->loose_count++] = (struct loose) { command.text, command.text_len, file->count };
+    }
+    // a pen-up SP while the pen is up only costs time
+  }
+  file->end_egg = egg;
+  file->end_pen = pen;
+  return !down;
+}
+
+// pen-up travel time: the axes move together, the egg the short way round.
+// points are kept in s of travel, the egg within one turn and the pen within its bounds.
+struct metric
+{
+  double egg_speed, pen_speed; // eggcode steps/s
+  double turn; // s for the egg to go all the way round
+};
+
+struct point
+{
+  double x, y;
+};
+
+static struct point travel_point(const struct metric *metric, int egg, int pen)
+{
+  const int turn = EGG_STEPS_PER_TURN;
+  const int low = PEN_LOW * PEN_STEPS_PER_UNIT, high = PEN_HIGH * PEN_STEPS_PER_UNIT;
+  egg = (egg % turn + turn) % turn;
+  pen = pen < low ? low : pen > high ? high : pen;
+  return (struct point) { egg / metric->egg_speed, pen / metric->pen_speed };
+}
+
+static double travel_time(const struct metric *metric, struct point a, struct point b)
+{
+  double dx = fabs(a.x - b.x), dy = fabs(a.y - b.y);
+  if (dx > metric->turn / 2) dx = metric->turn - dx;
+  return dx > dy ? dx : dy;
+}
+
+// stroke ends, 2 * stroke + 0 for the start and + 1 for the end, bucketed by position for nearest
+// neighbour lookups. cells wrap round the egg like the metric does.
+struct grid
+{
+  int columns, rows;
+  double width, height, y0; // of a cell; y of the first row
+  int *start, *count; // per cell, into `ends`
+  int *ends;
+  int *where; // index of each end in `ends`, -1 if it's not in the grid
+  int *cell; // of each end
+  int size;
+};
+
+static void grid_build(struct grid *grid, const struct metric *metric, const struct point *points, const int *ends, int count)
+{
+  double y0 = INFINITY, y1 = -INFINITY;
+  for (int i = 0; i < count; i++)
+  {
+    y0 = fmin(y0, points[ends[i]].y);
+    y1 = fmax(y1, points[ends[i]].y);
+  }
+  // square cells, about two ends to each
+  double cells_wanted = count > 2 ? count / 2.0 : 1;
+  double cell = sqrt(metric->turn * fmax(y1 - y0, metric->turn / cells_wanted) / cells_wanted);
+  grid->columns = (int) (metric->turn / cell);
+  if (grid->columns < 1) grid->columns = 1;
+  if (grid->columns > 4096) grid->columns = 4096;
+  grid->width = metric->turn / grid->columns;
+  grid->height = grid->width;
+  grid->rows = (int) ((y1 - y0) / grid->height) + 1;
+  if (grid->rows > 4096)
+  {
+    grid->rows = 4096;
+    grid->height = (y1 - y0) / (grid->rows - 1);
+  }
+  grid->y0 = y0;
+
+  int cells = grid->columns * grid->rows;
+  grid->start = realloc(grid->start, sizeof(int) * (cells + 1));
+  grid->count = realloc(grid->count, sizeof(int) * cells);
+  memset(grid->count, 0, sizeof(int) * cells);
+  for (int i = 0; i < count; i++)
+  {
+    struct point p = points[ends[i]];
+    int column = (int) (p.x / grid->width), row = (int) ((p.y - y0) / grid->height);
+    if (column >= grid->columns) column = grid->columns - 1;
+    if (row >= grid->rows) row = grid->rows - 1;
+    grid->cell[ends[i]] = row * grid->columns + column;
+    grid->count[grid->cell[ends[i]]]++;
+  }
+  grid->start[0] = 0;
+  for (int c = 0; c < cells; c++)
+  {
+    grid->start[c + 1] = grid->start[c] + grid->count[c];
+    grid->count[c] = 0;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    int c = grid->cell[ends[i]];
+    int at = grid->start[c] + grid->count[c]++;
+    grid->ends[at] = ends[i];
+    grid->where[ends[i]] = at;
+  }
+  grid->size = count;
+}
+
+static void grid_remove(struct grid *grid, int end)
+{
+  int at = grid->where[end];
+  if (at < 0) return;
+  int c = grid->cell[end];
+  int last = grid->start[c] + --grid->count[c];
+  grid->ends[at] = grid->ends[last];
+  grid->where[grid->ends[at]] = at;
+  grid->where[end] = -1;
+  grid->size--;
+}
+
+struct nearest
+{
+  int end;
+  double time;
+};
+
+static void grid_scan_cell(const struct grid *grid, const struct metric *metric, const struct point *points, struct point from, int c, struct nearest *nearest)
+{
+  for (int i = grid->start[c]; i < grid->start[c] + grid->count[c]; i++)
+  {
+    double t = travel_time(metric, from, points[grid->ends[i]]);
+    if (t < nearest->time)
+    {
+      *nearest = (struct nearest) { grid->ends[i], t };
+    }
+  }
+}
+
+// the end in the grid closest to `from`, or -1 if there is none. searches rings of cells outwards
+// until no cell further out can hold anything closer.
+static int grid_nearest(const struct grid *grid, const struct metric *metric, const struct point *points, struct point from)
+{
+  int column = (int) (from.x / grid->width), row = (int) ((from.y - grid->y0) / grid->height);
+  if (column >= grid->columns) column = grid->columns - 1;
+  if (row < 0) row = 0;
+  if (row >= grid->rows) row = grid->rows - 1;
+  // column offsets that reach each column once, the short way round
+  int left = -((grid->columns - 1) / 2), right = grid->columns / 2;
+  double cell = fmin(grid->width, grid->height);
+
+  struct nearest nearest = { -1, INFINITY };
+  for (int r = 0; r <= right || r <= -left || r < grid->rows; r++)
+  {
+    // everything in ring r is at least r - 1 cells away
+    if (nearest.end >= 0 && nearest.time <= (r - 1) * cell) break;
+    for (int dy = -r; dy <= r; dy++)
+    {
+      int y = row + dy;
+      if (y < 0 || y >= grid->rows) continue;
+      // the top and bottom row of the ring are whole, the rows between only have their ends
+      int step = (dy == -r || dy == r) ? 1 : 2 * r;
+      for (int dx = -r; dx <= r; dx += step)
+      {
+        if (dx >= left && dx <= right)
+        {
+          grid_scan_cell(grid, metric, points, from, y * grid->columns + (column + dx + grid->columns) % grid->columns, &nearest);
+        }
+      }
+    }
+  }
+  return nearest.end;
+}
+
+// the order the strokes are drawn in, and which way round
+struct tour
+{
+  int *order;
+  bool *reversed;
+  int count;
+};
+
+static struct point entry_point(const struct point *points, const struct tour *tour, int i)
+{
+  return points[2 * tour->order[i] + tour->reversed[i]];
+}
+
+static struct point exit_point(const struct point *points, const struct tour *tour, int i)
+{
+  return points[2 * tour->order[i] + !tour->reversed[i]];
+}
+
+// greedy: always go on to the closest stroke end not drawn yet
+static void tour_greedy(struct tour *tour, const struct strokes *file, const struct metric *metric, const struct point *points)
+{
+  int n = file->count;
+  struct grid grid = {
+    .ends = malloc(sizeof(int) * 2 * n),
+    .where = malloc(sizeof(int) * 2 * n),
+    .cell = malloc(sizeof(int) * 2 * n),
+  };
+  int *ends = calloc(2 * n, sizeof(int));
+  int count = 0;
+  for (int s = 0; s < n; s++)
+  {
+    grid.where[2 * s] = grid.where[2 * s + 1] = -1;
+    ends[count++] = 2 * s;
+    // only reversible strokes may be entered at their end
+    if (file->strokes[s].reversible) ends[count++] = 2 * s + 1;
+  }
+  grid_build(&grid, metric, points, ends, count);
+
+  struct point at = travel_point(metric, 0, 0);
+  for (int i = 0; i < n; i++)
+  {
+    int end = grid_nearest(&grid, metric, points, at);
+    int s = end / 2;
+    tour->order[i] = s;
+    tour->reversed[i] = end % 2;
+    at = exit_point(points, tour, i);
+    grid_remove(&grid, 2 * s);
+    grid_remove(&grid, 2 * s + 1);
+
+    // as the grid empties, searches cross more and more empty cells; start over with fewer
+    if (grid.size > 0 && grid.size * 8 < grid.columns * grid.rows)
+    {
+      count = 0;
+      for (int c = 0; c < grid.columns * grid.rows; c++)
+      {
+        for (int k = grid.start[c]; k < grid.start[c] + grid.count[c]; k++) ends[count++] = grid.ends[k];
+      }
+      grid_build(&grid, metric, points, ends, count);
+    }
+  }
+  free(ends);
+  free(grid.ends);
+  free(grid.where);
+  free(grid.cell);
+  free(grid.start);
+  free(grid.count);
+}
+
+// 2-opt: draw a run of up to OPTIMIZE_WINDOW strokes in reverse order, each backwards, wherever that
+// shortens the travel into and out of the run
+static void tour_2opt(struct tour *tour, const struct strokes *file, const struct metric *metric, const struct point *points)
+{
+  struct point start = travel_point(metric, 0, 0);
+  struct point finish = travel_point(metric, file->end_egg, file->end_pen);
+  int n = tour->count;
+  for (int pass = 0; pass < OPTIMIZE_PASSES; pass++)
+  {
+    bool improved = false;
+    for (int i = 0; i < n; i++)
+    {
+      struct point before = i > 0 ? exit_point(points, tour, i - 1) : start;
+      for (int j = i; j < n && j < i + OPTIMIZE_WINDOW; j++)
+      {
+        if (!file->strokes[tour->order[j]].reversible) break;
+        struct point after = j + 1 < n ? entry_point(points, tour, j + 1) : finish;
+        struct point first = entry_point(points, tour, i), last = exit_point(points, tour, j);
+        double gain = travel_time(metric, before, first) + travel_time(metric, last, after)
+          - travel_time(metric, before, last) - travel_time(metric, first, after);
+        if (gain <= 1e-9) continue;
+
+        for (int a = i, b = j; a <= b; a++, b--)
+        {
+          int order = tour->order[a];
+          bool reversed = tour->reversed[a];
+          tour->order[a] = tour->order[b];
+          tour->reversed[a] = !tour->reversed[b];
+          tour->order[b] = order;
+          tour->reversed[b] = !reversed;
+        }
+        improved = true;
+      }
+    }
+    if (!improved) break;
+  }
+}
+
+struct output
+{
+  char *data;
+  size_t length, capacity;
+};
+
+static void output_append(struct output *output, const char *text, size_t length)
+{
+  while (output->length + length > output->capacity)
+  {
+    output->capacity = output->capacity ? output->capacity * 2 : 4096;
+    output->data = realloc(output->data, output->capacity);
+    if (!output->data)
+    {
+      fprintf(stderr, "out of memory\n");
+      abort();
+    }
+  }
+  memcpy(output->data + output->length, text, length);
+  output->length += length;
+}
+
+static void output_printf(struct output *output, const char *fmt, ...)
+{
+  char line[64];
+  va_list args;
+  va_start(args, fmt);
+  int length = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  output_append(output, line, length);
+}
+
+static void output_line(struct output *output, const char *text, int text_len)
+{
+  output_append(output, text, text_len);
+  output_append(output, "\n", 1);
+}
+
+// a pen-up SM from (*egg, *pen) to where `to_egg`, `to_pen` is, the short way round the egg
+static void emit_travel(struct output *output, const struct metric *metric, int *egg, int *pen, int to_egg, int to_pen, double *travel)
+{
+  const int turn = EGG_STEPS_PER_TURN;
+  int degg = ((to_egg - *egg) % turn + turn) % turn;
+  if (degg > turn / 2) degg -= turn;
+  int dpen = to_pen - *pen;
+  if (degg == 0 && dpen == 0) return;
+
+  int dt_ms = (int) ceil(1000 * fmax(abs(degg) / metric->egg_speed, abs(dpen) / metric->pen_speed));
+  output_printf(output, "SM,%i,%i,%i\n", dt_ms, dpen, degg);
+  *egg += degg;
+  *pen += dpen;
+  *travel += dt_ms / 1000.0;
+}
+
+static void emit_stroke(struct output *output, const struct stroke *stroke, bool reversed, const char *filename)
+{
+  struct eggcode_parser parser = {
+    .filename = filename,
+    .data = stroke->text,
+    .end = stroke->end,
+    .cursor = stroke->text,
+    .line = 1,
+  };
+  struct eggcode_command command;
+  if (!reversed)
+  {
+    while (eggcode_next(&parser, &command)) output_line(output, command.text, command.text_len);
+    return;
+  }
+
+  // the SPs stay put, the SMs between them run backwards
+  struct eggcode_command first, last;
+  eggcode_next(&parser, &first);
+  const char *moves = parser.cursor;
+  while (eggcode_next(&parser, &last));
+  output_line(output, first.text, first.text_len);
+  for (const char *line_end = last.text; line_end > moves;)
+  {
+    // find the start of the line before `line_end`
+    const char *line = line_end - 1;
+    while (line > moves && line[-1] != '\n') line--;
+    struct eggcode_parser move_parser = parser;
+    move_parser.data = move_parser.cursor = line;
+    move_parser.end = line_end;
+    if (eggcode_next(&move_parser, &command))
+    {
+      output_printf(output, "SM,%i,%i,%i\n", command.args[0], -command.args[1], -command.args[2]);
+    }
+    line_end = line;
+  }
+  output_line(output, last.text, last.text_len);
+}
+
+bool eggcode_optimize(struct eggcode_parser *parser, struct optimize_stats *stats)
+{
+  if (parser->record || parser->stream) return false;
+
+  struct strokes file = { 0 };
+  if (!cut_strokes(parser, &file) || file.count == 0)
+  {
+    free(file.strokes);
+    free(file.loose);
+    parser->cursor = parser->data;
+    parser->line = 1;
+    return false;
+  }
+
+  // travel no faster than the file already does, nor than the planner allows
+  double egg_max = PLANNER_EGG_MAX_SPEED * EGG_STEPS_PER_UNIT, pen_max = PLANNER_PEN_MAX_SPEED * PEN_STEPS_PER_UNIT;
+  struct metric metric = {
+    .egg_speed = file.egg_speed > 0 ? fmin(file.egg_speed, egg_max) : egg_max,
+    .pen_speed = file.pen_speed > 0 ? fmin(file.pen_speed, pen_max) : pen_max,
+  };
+  metric.turn = EGG_STEPS_PER_TURN / metric.egg_speed;
+
+  int n = file.count;
+  struct point *points = calloc(2 * n, sizeof(struct point));
+  for (int s = 0; s < n; s++)
+  {
+    points[2 * s] = travel_point(&metric, file.strokes[s].egg[0], file.strokes[s].pen[0]);
+    points[2 * s + 1] = travel_point(&metric, file.strokes[s].egg[1], file.strokes[s].pen[1]);
+  }
+  struct tour tour = {
+    .order = malloc(sizeof(int) * n),
+    .reversed = malloc(sizeof(bool) * n),
+    .count = n,
+  };
+  tour_greedy(&tour, &file, &metric, points);
+  tour_2opt(&tour, &file, &metric, points);
+
+  *stats = (struct optimize_stats) { .strokes = n, .travel_before = file.travel };
+  struct output output = { 0 };
+  size_t loose = 0;
+  // commands between strokes can't stay between the same strokes; they go first
+  for (; loose < file.loose_count && file.loose[loose].strokes_before < file.count; loose++)
+  {
+    output_line(&output, file.loose[loose].text, file.loose[loose].text_len);
+  }
+  int egg = 0, pen = 0;
+  for (int i = 0; i < n; i++)
+  {
+    const struct stroke *stroke = &file.strokes[tour.order[i]];
+    bool reversed = tour.reversed[i];
+    emit_travel(&output, &metric, &egg, &pen, stroke->egg[reversed], stroke->pen[reversed], &stats->travel_after);
+    emit_stroke(&output, stroke, reversed, parser->filename);
+    egg += stroke->egg[!reversed] - stroke->egg[reversed];
+    pen += stroke->pen[!reversed] - stroke->pen[reversed];
+    stats->reversed += reversed;
+  }
+  emit_travel(&output, &metric, &egg, &pen, file.end_egg, file.end_pen, &stats->travel_after);
+  for (; loose < file.loose_count; loose++)
+  {
+    output_line(&output, file.loose[loose].text, file.loose[loose].text_len);
+  }
+
+  const char *filename = parser->filename;
+  eggcode_close(parser);
+  eggcode_open_buffer(parser, filename, output.data, output.length);
+
+  free(points);
+  free(tour.order);
+  free(tour.reversed);
+  free(file.strokes);
+  free(file.loose);
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef RASPBERRYEGG_OPTIMIZE_H
+#define RASPBERRYEGG_OPTIMIZE_H
+
+#include <stdbool.h>
+
+#include "eggcode.h"
+
+// pen-up travel optimizer. the file is cut into strokes, each running from a pen-down SP to the
+// pen-up SP after it. strokes are reordered, and some drawn backwards, so that less time goes into
+// travelling between them, taking the short way round the egg. the pen-up moves are then made up
+// anew at the fastest speed the file travelled at. everything drawn stays where it was.
+
+struct optimize_stats
+{
+  int strokes, reversed;
+  double travel_before, travel_after; // s of pen-up SM moves
+};
+
+// make the parser read the reordered file instead; line numbers then count in that.
+// returns false and leaves the parser as it was if there are no strokes, or the file ends with the pen down,
+// or it's binary eggcode: that has no lines to move around, so reorder it when converting it instead,
+// or it's streamed: the whole file would have to be kept.
+// the parser must not have been read from yet.
+bool eggcode_optimize(struct eggcode_parser *parser, struct optimize_stats *stats);
+
+#endif
@@ -0,0 +1,168 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "overlap.h"
+
+void overlap_init(struct pen_overlap *overlap, struct servo_config servo, float clearance)
+{
+  // the driver starts with the pen raised
+  *overlap = (struct pen_overlap) { .servo_config = servo, .clearance = clearance, .servo = 1.0 };
+}
+
+static struct overlap_move *overlap_move(struct pen_overlap *overlap, int i)
+{
+  return &overlap->moves[(overlap->first + i) % OVERLAP_MOVES];
+}
+
+static void append(struct pen_overlap *overlap, coordinate from, coordinate to, float dt)
+{
+  if (overlap->count == OVERLAP_MOVES)
+  {
+    fprintf(stderr, "pen overlap: moves not taken off\n");
+    abort();
+  }
+  *overlap_move(overlap, overlap->count++) = (struct overlap_move) { from, to, dt };
+  overlap->to = to;
+}
+
+static void release_all(struct pen_overlap *overlap)
+{
+  overlap->ready = overlap->count;
+  overlap->held_s = 0;
+}
+
+// how long the servo takes from a to b at the pace of the pen change from `from` to `to` in `dt`
+static double servo_span(struct pen_overlap *overlap, coordinate from, coordinate to, float dt, float a, float b)
+{
+  struct servo_config servo = overlap->servo_config;
+  float whole = servo_factor(servo, to.servo) - servo_factor(servo, from.servo);
+  return dt * fabsf((servo_factor(servo, b) - servo_factor(servo, a)) / whole);
+}
+
+// after the held travel, move the servo with the axes standing still
+static void servo_still(struct pen_overlap *overlap, coordinate at, float from_servo, float to_servo, double dt)
+{
+  release_all(overlap);
+  overlap->servo = to_servo;
+  if (dt <= 0) return;
+
+  at.egg_speed = 0;
+  at.pen_speed = 0;
+  coordinate from = at, to = at;
+  from.servo = from_servo;
+  to.servo = to_servo;
+  append(overlap, from, to, dt);
+  release_all(overlap);
+  overlap->still_s += dt;
+}
+
+// bring the servo down from `top` to `end` over the last `span` s of the held travel, so it's at `end`
+// as the axes stop. moves that already have the servo lower keep it there
+static void ramp_held(struct pen_overlap *overlap, double span, float end, float top)
+{
+  double t = 0; // from the end of the held travel back
+  for (int i = overlap->count - 1; i >= overlap->ready && t < span; i--)
+  {
+    struct overlap_move *move = overlap_move(overlap, i);
+    move->to.servo = fminf(move->to.servo, blend(t / span, end, top));
+    if (i + 1 < overlap->count) overlap_move(overlap, i + 1)->from.servo = move->to.servo;
+    t += move->dt;
+  }
+}
+
+static void pen_change(struct pen_overlap *overlap, coordinate from, coordinate to, float dt)
+{
+  float start = overlap->servo, clearance = overlap->clearance;
+  overlap->changes++;
+  overlap->change_s += dt;
+  // a lift that isn't done yet turns round where it got to
+  overlap->rise_left = 0;
+  // a drop at this pace takes this long from up to the clearance
+  overlap->window = servo_span(overlap, from, to, dt, 1.0, clearance);
+
+  if (to.servo < start && start > clearance && to.servo < clearance)
+  {
+    // drop: down to the clearance during the travel, as far as it goes back, then the rest standing still
+    double span = servo_span(overlap, from, to, dt, start, clearance);
+    double overlapped = fmin(span, overlap->held_s);
+    float end = blend(overlapped / span, start, clearance);
+    if (overlapped > 0) ramp_held(overlap, overlapped, end, start);
+    servo_still(overlap, to, end, to.servo, servo_span(overlap, from, to, dt, end, to.servo));
+  }
+  else if (to.servo > start && start < clearance && to.servo > clearance)
+  {
+    // lift: up to the clearance standing still, the rest during the travel after it
+    servo_still(overlap, to, start, clearance, servo_span(overlap, from, to, dt, start, clearance));
+    overlap->rise_to = to.servo;
+    overlap->rise_left = servo_span(overlap, from, to, dt, clearance, to.servo);
+  }
+  else
+  {
+    servo_still(overlap, to, start, to.servo, servo_span(overlap, from, to, dt, start, to.servo));
+  }
+}
+
+static void travel(struct pen_overlap *overlap, coordinate from, coordinate to, float dt)
+{
+  from.servo = overlap->servo;
+  to.servo = overlap->servo;
+  if (overlap->rise_left > 0)
+  {
+    to.servo = blend(fmin(1.0, dt / overlap->rise_left), overlap->servo, overlap->rise_to);
+    overlap->rise_left = fmax(0.0, overlap->rise_left - dt);
+  }
+  overlap->servo = to.servo;
+  append(overlap, from, to, dt);
+  overlap->held_s += dt;
+
+  // hold back only as much as the next drop can use, and leave room for the moves a push adds
+  while (overlap->ready < overlap->count)
+  {
+    float oldest = overlap_move(overlap, overlap->ready)->dt;
+    if (overlap->count < OVERLAP_MOVES - 2 && overlap->held_s - oldest < overlap->window) break;
+    overlap->held_s -= oldest;
+    overlap->ready++;
+  }
+}
+
+void overlap_push(struct pen_overlap *overlap, coordinate from, coordinate to, float dt)
+{
+  bool still = from.egg.fixed == to.egg.fixed && from.pen.fixed == to.pen.fixed;
+  if (still && from.servo != to.servo)
+  {
+    pen_change(overlap, from, to, dt);
+    return;
+  }
+  if (!still && from.servo == to.servo && to.servo > overlap->clearance && overlap->servo >= overlap->clearance)
+  {
+    travel(overlap, from, to, dt);
+    return;
+  }
+  // drawing, or anything else: runs as it is, after what came before
+  overlap_flush(overlap);
+  append(overlap, from, to, dt);
+  release_all(overlap);
+  overlap->servo = to.servo;
+}
+
+void overlap_flush(struct pen_overlap *overlap)
+{
+  if (overlap->rise_left > 0)
+  {
+    double left = overlap->rise_left;
+    overlap->rise_left = 0;
+    servo_still(overlap, overlap->to, overlap->servo, overlap->rise_to, left);
+  }
+  release_all(overlap);
+}
+
+bool overlap_pop(struct pen_overlap *overlap, struct overlap_move *move)
+{
+  if (overlap->ready == 0) return false;
+  *move = overlap->moves[overlap->first];
+  overlap->first = (overlap->first + 1) % OVERLAP_MOVES;
+  overlap->count--;
+  overlap->ready--;
+  return true;
+}
@@ -0,0 +1,66 @@
+#ifndef RASPBERRYEGG_OVERLAP_H
+#define RASPBERRYEGG_OVERLAP_H
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "motion.h"
+
+// overlaps pen changes with the pen-up travel around them, instead of standing still for all of an SP.
+// the axes may only move while the pen is clear of the egg: while the servo is past `clearance` of its
+// travel from down to up, measured in servo_factor() pulse widths. so a lift runs on its own up to the
+// clearance, and the rest of it is spread over the travel after it; a drop starts during the last part
+// of the travel before it, to reach the clearance just as the axes stop.
+// the servo never moves faster than the SP asked for.
+
+struct overlap_move
+{
+  coordinate from, to;
+  float dt;
+};
+
+struct pen_overlap
+{
+  struct servo_config servo_config;
+  float clearance; // as a servo position: 0 down, 1 up
+  // moves in order; the first `ready` of them can go, the rest is pen-up travel held back for a drop
+  struct overlap_move moves[OVERLAP_MOVES];
+  int first, count, ready;
+  double held_s; // of the moves held back
+  double window; // how much travel to hold back: as long as the last pen change takes down to the clearance
+  float servo; // where the servo is at the end of the last move
+  coordinate to; // and the axes
+  // what's left of the last lift, to be done during the travel after it
+  float rise_to;
+  double rise_left;
+  // for the report
+  int changes;
+  double change_s, still_s; // what the pen changes asked for, and how long the axes stood still for them
+};
+
+void overlap_init(struct pen_overlap *overlap, struct servo_config servo, float clearance);
+
+// a task as queue_task() takes it
+void overlap_push(struct pen_overlap *overlap, coordinate from, coordinate to, float dt);
+
+// finish the lift and let the held travel go, for the end of a file or a pause
+void overlap_flush(struct pen_overlap *overlap);
+
+// the next move to queue, if any is ready
+bool overlap_pop(struct pen_overlap *overlap, struct overlap_move *move);
+
+static inline void overlap_clear_stats(struct pen_overlap *overlap)
+{
+  overlap->changes = 0;
+  overlap->change_s = 0;
+  overlap->still_s = 0;
+}
+
+// time saved over running every pen change on its own; the spans are summed in float, so keep off -0.0
+static inline double overlap_saved(struct pen_overlap *overlap)
+{
+  return fmax(0.0, overlap->change_s - overlap->still_s);
+}
+
+#endif
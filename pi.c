@@ -1,7 +1,10 @@
+#include <string.h>
+
 #include "pi.h"
 
 volatile uint32_t *gpio_port;
 uint32_t gpio_reset_mask = 0;
+_Atomic uint32_t *gpio_levels = NULL;
 
 void *mmap_bcm_register(off_t register_offset)
 {
@@ -33,6 +36,20 @@ void *mmap_bcm_register(off_t register_offset)
   return result;
 }
 
+void *memory_register_page()
+{
+  void *result = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+  if (!result)
+  {
+    fprintf(stderr, "can't allocate register page\n");
+    abort();
+  }
+  memset(result, 0, PAGE_SIZE);
+  gpio_levels = (_Atomic uint32_t*) ((char*) result + GPIO_LEV_OFFSET);
+  atomic_init(gpio_levels, 0);
+  return result;
+}
+
 void initialize_gpio_for_output(int bit)
 {
   *(gpio_port+(bit/10)) &= ~(7<<((bit%10)*3));  // prepare: set as input
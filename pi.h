@@ -2,12 +2,15 @@
 #define RASPBERRYPI_PI_H
 
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include "trace.h"
+
 // thanks rpi-gpio-dma-demo
 
 #ifndef PI_VERSION
@@ -29,13 +32,51 @@
 #define GPIO_REGISTER_BASE 0x200000
 #define GPIO_SET_OFFSET 0x1C
 #define GPIO_CLR_OFFSET 0x28
+#define GPIO_LEV_OFFSET 0x34
 #define PHYSICAL_GPIO_BUS (0x7E000000 + GPIO_REGISTER_BASE)
 
 extern volatile uint32_t *gpio_port;
 extern uint32_t gpio_reset_mask;
+// with the memory backend, the level register as the set/clr writes leave it. the workers of all
+// machines write through gpio_write() at once, each to its own pins, so it's kept with atomic ops.
+// the real set/clr registers only act on the bits written as 1, so there's nothing to merge there.
+// NULL on the real registers.
+extern _Atomic uint32_t *gpio_levels;
+
+enum gpio_backend
+{
+  GPIO_BACKEND_DEVMEM, // the real registers
+  GPIO_BACKEND_MEMORY, // an ordinary page standing in for them, so everything runs off the pi
+};
 
 void *mmap_bcm_register(off_t register_offset);
 
+// a zeroed page in place of the bcm register block; also points gpio_levels into it
+void *memory_register_page();
+
+static inline void gpio_levels_update(uint32_t set, uint32_t clr)
+{
+  atomic_fetch_and_explicit(gpio_levels, ~clr, memory_order_relaxed);
+  atomic_fetch_or_explicit(gpio_levels, set, memory_order_relaxed);
+}
+
+static inline void gpio_write(volatile uint32_t *set_reg, volatile uint32_t *clr_reg, uint32_t set, uint32_t clr)
+{
+  *clr_reg = clr;
+  *set_reg = set;
+  if (gpio_levels && (set | clr)) gpio_levels_update(set, clr);
+  if (gpio_trace) trace_record(set, clr);
+}
+
+// like gpio_write(), but leaves a register alone when there's nothing to write to it
+static inline void gpio_write_changes(volatile uint32_t *set_reg, volatile uint32_t *clr_reg, uint32_t set, uint32_t clr)
+{
+  if (clr) *clr_reg = clr;
+  if (set) *set_reg = set;
+  if (gpio_levels && (set | clr)) gpio_levels_update(set, clr);
+  if (gpio_trace) trace_record(set, clr);
+}
+
 void initialize_gpio_for_output(int bit);
 
 #endif
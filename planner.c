@@ -0,0 +1,178 @@
+#include <math.h>
+
+#include "planner.h"
+#include "util.h"
+
+void planner_init(struct planner *planner, struct planner_config config)
+{
+  *planner = (struct planner) { .config = config };
+}
+
+static struct planner_segment *planner_segment(struct planner *planner, size_t i)
+{
+  return &planner->segments[(planner->first + i) % PLANNER_LOOKAHEAD];
+}
+
+// how fast an axis moving `from` of a move then `to` of the next may cross the junction without
+// changing speed by more than `jump`; both are fractions of their move's length
+static float junction_limit(float from, float to, float jump)
+{
+  float change = fabsf(to - from);
+  return change > 0 ? jump / change : INFINITY;
+}
+
+// how fast the move can run along its length if neither axis may go over `limit_egg`/`limit_pen`
+static float axis_limit(float egg, float pen, float length, float limit_egg, float limit_pen)
+{
+  float egg_limit = egg != 0 ? limit_egg * length / fabsf(egg) : INFINITY;
+  float pen_limit = pen != 0 ? limit_pen * length / fabsf(pen) : INFINITY;
+  return fminf(egg_limit, pen_limit);
+}
+
+// the fastest we can be going after `length` of constant acceleration from `speed`
+static float reachable_speed(float speed, float accel, float length)
+{
+  return sqrtf(speed * speed + 2 * accel * length);
+}
+
+// the first segment's entry speed is committed; everything after it is replanned
+// so that the window ends at rest, then forward again so no segment accelerates past its limit.
+static void planner_recalculate(struct planner *planner)
+{
+  float next_entry = 0;
+  for (size_t i = planner->count - 1; i > 0; i--)
+  {
+    struct planner_segment *segment = planner_segment(planner, i);
+    segment->entry_speed = fminf(segment->max_entry_speed, reachable_speed(next_entry, segment->accel, segment->length));
+    next_entry = segment->entry_speed;
+  }
+  for (size_t i = 0; i + 1 < planner->count; i++)
+  {
+    struct planner_segment *segment = planner_segment(planner, i);
+    struct planner_segment *next = planner_segment(planner, i + 1);
+    next->entry_speed = fminf(next->entry_speed, reachable_speed(segment->entry_speed, segment->accel, segment->length));
+  }
+}
+
+void planner_push(struct planner *planner, double egg, double pen, float dt)
+{
+  struct planner_config *config = &planner->config;
+  float length = hypot(egg, pen);
+  float nominal_speed = fminf(
+    dt > 0 ? length / dt : INFINITY,
+    axis_limit(egg, pen, length, config->egg_max_speed, config->pen_max_speed)
+  );
+
+  struct planner_segment segment = {
+    .egg = egg,
+    .pen = pen,
+    .length = length,
+    .nominal_speed = nominal_speed,
+    .accel = axis_limit(egg, pen, length, config->egg_accel, config->pen_accel),
+    .max_entry_speed = 0, // from a standstill, unless there's a segment before us
+  };
+
+  if (!planner_empty(planner))
+  {
+    struct planner_segment *previous = planner_segment(planner, planner->count - 1);
+    segment.max_entry_speed = fminf(
+      fminf(nominal_speed, previous->nominal_speed),
+      fminf(
+        junction_limit(previous->egg / previous->length, egg / length, config->egg_jump),
+        junction_limit(previous->pen / previous->length, pen / length, config->pen_jump)
+      )
+    );
+  }
+
+  *planner_segment(planner, planner->count) = segment;
+  planner->count++;
+  planner_recalculate(planner);
+}
+
+// part of a segment at constant acceleration
+struct phase
+{
+  float length, start, end; // start and end speed
+};
+
+static float phase_dt(struct phase phase)
+{
+  // constant acceleration, so the average of start and end speed covers the distance
+  return 2 * phase.length / (phase.start + phase.end);
+}
+
+static bool phase_short(struct phase phase, float length)
+{
+  return phase.length <= length * 1e-4f || phase_dt(phase) < PLANNER_MIN_PHASE;
+}
+
+int planner_pop(struct planner *planner, struct planner_move *moves)
+{
+  struct planner_segment segment = *planner_segment(planner, 0);
+  float exit_speed = planner->count > 1 ? planner_segment(planner, 1)->entry_speed : 0;
+  planner->first = (planner->first + 1) % PLANNER_LOOKAHEAD;
+  planner->count--;
+
+  // trapezoid: accelerate at `accel` up to `cruise`, hold it, decelerate to the exit speed.
+  // if the segment is too short to reach the nominal speed, the cruise phase drops out.
+  float v0 = segment.entry_speed, v1 = exit_speed, accel = segment.accel, length = segment.length;
+  float peak = sqrtf(fmaxf((2 * accel * length + v0 * v0 + v1 * v1) / 2, 0));
+  float cruise = fminf(segment.nominal_speed, peak);
+  cruise = fmaxf(cruise, fmaxf(v0, v1));
+
+  float accel_length = fminf((cruise * cruise - v0 * v0) / (2 * accel), length);
+  float decel_length = fminf((cruise * cruise - v1 * v1) / (2 * accel), length - accel_length);
+  float cruise_length = length - accel_length - decel_length;
+
+  struct phase phases[3] = {
+    { accel_length, v0, cruise },
+    { cruise_length, cruise, cruise },
+    { decel_length, cruise, v1 },
+  };
+  int count = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    if (phases[i].length > 0) phases[count++] = phases[i];
+  }
+  // rounding can leave a sliver of a phase, over which any error in its distance would turn into a huge
+  // acceleration. it's merged with a phase next to it, into one of constant acceleration from the start
+  // of the first to the end of the second: the speeds still match at both ends, and the same change
+  // in speed over the longer distance never takes more acceleration than either of the two did
+  for (int i = 0; i < count && count > 1;)
+  {
+    if (!phase_short(phases[i], length))
+    {
+      i++;
+      continue;
+    }
+    int merged = i > 0 ? i - 1 : i;
+    phases[merged] = (struct phase) {
+      phases[merged].length + phases[merged + 1].length, phases[merged].start, phases[merged + 1].end
+    };
+    for (int k = merged + 1; k + 1 < count; k++)
+    {
+      phases[k] = phases[k + 1];
+    }
+    count--;
+    i = 0;
+  }
+
+  // each phase gets its share of the distance on the unit grid, the last one what's left
+  int64_t egg_left = unit_fixed(segment.egg), pen_left = unit_fixed(segment.pen);
+  for (int i = 0; i < count; i++)
+  {
+    double f = phases[i].length / length;
+    int64_t egg = i + 1 < count ? unit_fixed(segment.egg * f) : egg_left;
+    int64_t pen = i + 1 < count ? unit_fixed(segment.pen * f) : pen_left;
+    egg_left -= egg;
+    pen_left -= pen;
+    moves[i] = (struct planner_move) {
+      .egg = egg / (double) UNIT_ONE,
+      .pen = pen / (double) UNIT_ONE,
+      .egg_speed = phases[i].start * segment.egg / length,
+      .pen_speed = phases[i].start * segment.pen / length,
+      .dt = phase_dt(phases[i]),
+    };
+  }
+  return count;
+}
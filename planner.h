@@ -0,0 +1,68 @@
+#ifndef RASPBERRYEGG_PLANNER_H
+#define RASPBERRYEGG_PLANNER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+
+// lookahead planning for SM moves: instead of jumping to each move's speed, moves are run as
+// accelerate/cruise/decelerate profiles, and consecutive moves keep as much speed through their
+// junction as the steppers take without a ramp.
+// all distances are in units (one full step cycle), speeds in units/s. distances are kept in double and
+// split into moves on the 2^-32 grid positions are on, so planning doesn't lose or add any; only the speed
+// and time math is done in float.
+
+struct planner_config
+{
+  float egg_accel, pen_accel; // in units/s^2
+  float egg_jump, pen_jump; // largest speed change a stepper takes instantly, at a junction
+  float egg_max_speed, pen_max_speed;
+};
+
+struct planner_segment
+{
+  double egg, pen;
+  float length; // of the (egg, pen) vector
+  float nominal_speed; // along the move; what the eggcode asked for, within the max speeds
+  float accel; // along the move, the most both axes take
+  float max_entry_speed; // from the junction with the previous segment
+  float entry_speed; // as planned so far
+};
+
+// a piece of a segment at constant acceleration, in the form step() takes it
+struct planner_move
+{
+  double egg, pen; // whole multiples of 2^-32, so they add up to the segment exactly
+  float egg_speed, pen_speed; // at the start of the move
+  float dt;
+};
+
+struct planner
+{
+  struct planner_config config;
+  struct planner_segment segments[PLANNER_LOOKAHEAD];
+  size_t first, count;
+};
+
+void planner_init(struct planner *planner, struct planner_config config);
+
+static inline bool planner_full(struct planner *planner)
+{
+  return planner->count == PLANNER_LOOKAHEAD;
+}
+
+static inline bool planner_empty(struct planner *planner)
+{
+  return planner->count == 0;
+}
+
+// add a move that the eggcode wants done in `dt` s. the planner must not be full.
+// zero-length moves are not planned; flush the planner and run them directly.
+void planner_push(struct planner *planner, double egg, double pen, float dt);
+
+// commit the oldest segment, as planned to come to a stop at the end of the lookahead window.
+// fills up to three moves; returns how many.
+int planner_pop(struct planner *planner, struct planner_move *moves);
+
+#endif
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "prepare.h"
+#include "step.h"
+
+struct preparer *preparer_create(const struct eggbot_config *config, struct task_ring_buffer *tasks)
+{
+  struct preparer *preparer = aligned_alloc(RINGBUFFER_CACHE_LINE, sizeof(struct preparer));
+  if (!preparer)
+  {
+    fprintf(stderr, "can't allocate the frame preparer\n");
+    abort();
+  }
+  preparer->config = *config;
+  preparer->tasks = tasks;
+  // the worker keeps its own time on these, so no watermarks
+  preparer->blocks = ringbuffer_init(PREPARE_BLOCKS, INFINITY, INFINITY);
+  preparer->pool_size = preparer->blocks->length + 2;
+  preparer->pool = malloc(sizeof(struct frame_block) * preparer->pool_size);
+  preparer->next = 0;
+  preparer->stream_s = 0;
+  atomic_init(&preparer->cycles_per_s, config->cycles_per_s);
+  atomic_init(&preparer->lag, 0);
+
+  int length = config->pwm_config.length_pow2;
+  preparer->block_frames = PREPARE_BLOCK_WORDS / length > 0 ? PREPARE_BLOCK_WORDS / length : 1;
+  preparer->frames = malloc(sizeof(struct frame) * preparer->block_frames);
+  int words = preparer->block_frames * length;
+  for (size_t i = 0; i < preparer->pool_size; i++)
+  {
+    int capacity = 0;
+    preparer->pool[i] = (struct frame_block) { 0 };
+    frame_words_buffer(&preparer->pool[i].words, &capacity, words);
+  }
+  return preparer;
+}
+
+// where the move is a fraction `f` of the way through
+static coordinate move_at(coordinate from, coordinate to, float dt, double f)
+{
+  if (f >= 1) return to;
+
+  double t = f * dt;
+  double egg_accel = move_accel(unit_diff_f(from.egg, to.egg), dt, from.egg_speed);
+  double pen_accel = move_accel(unit_diff_f(from.pen, to.pen), dt, from.pen_speed);
+  coordinate at = coord_advance(
+    from,
+    egg_accel / 2 * t * t + from.egg_speed * t,
+    pen_accel / 2 * t * t + from.pen_speed * t,
+    blend(f, from.servo, to.servo)
+  );
+  at.egg_speed = egg_accel * t + from.egg_speed;
+  at.pen_speed = pen_accel * t + from.pen_speed;
+  return at;
+}
+
+void prepare_move(struct preparer *preparer, coordinate from, coordinate to, float dt)
+{
+  if (dt < 0)
+  {
+    fprintf(stderr, "Time travel detected!\n");
+    abort();
+  }
+
+  struct eggbot_config *config = &preparer->config;
+  config->cycles_per_s = atomic_load_explicit(&preparer->cycles_per_s, memory_order_relaxed);
+  // step() would stretch or squeeze the move to its deadline once it starts; the blocks are
+  // sized before then, so take off part of the lag the worker last reported instead
+  double lag = atomic_load_explicit(&preparer->lag, memory_order_relaxed);
+  double correction = fmax(-dt * DEADLINE_SLACK, fmin(dt * DEADLINE_SLACK, lag * fmin(1.0, dt / RATE_TIME_CONSTANT)));
+  int cycles = (int) ((dt - correction) * config->cycles_per_s);
+
+  struct motion motion;
+  motion_init(&motion, config, from, to, dt, cycles, false);
+  uint32_t pin_mask = config_pin_mask(config);
+  int length = config->pwm_config.length_pow2;
+
+  uint32_t last_bits = 0;
+  for (int i = 0; i < cycles || i == 0; /* i is incremented by the frame loop below */)
+  {
+    struct frame_block *block = &preparer->pool[preparer->next++ % preparer->pool_size];
+    block->count = 0;
+    block->first = i == 0;
+    block->dt = dt;
+    block->cycles = cycles;
+
+    struct frame *frames = preparer->frames;
+    int frame_count = 0, pwm_len = length;
+    for (; frame_count < preparer->block_frames && i < cycles; frame_count++)
+    {
+      motion_frame(&motion, config, i, preparer->stream_s, &frames[frame_count]);
+      pwm_len = min(length, cycles - i);
+      preparer->stream_s += pwm_len / config->cycles_per_s;
+      i += pwm_len;
+    }
+    // whole frames, then the move's short last one on its own
+    int whole = pwm_len < length ? frame_count - 1 : frame_count;
+    frame_words(frames, whole, length, &last_bits, block->words);
+    block->count = whole * length;
+    if (whole < frame_count)
+    {
+      frame_words(&frames[whole], 1, pwm_len, &last_bits, block->words + block->count);
+      block->count += pwm_len;
+    }
+    if (block->first && block->count > 0)
+    {
+      // only changes are written from here on; drop whatever was left on before
+      block->words[0].clr = pin_mask & ~block->words[0].set;
+    }
+    block->last = i >= cycles;
+    block->at = move_at(from, to, dt, cycles ? (double) i / cycles : 1);
+
+    ringbuffer_queue(preparer->blocks, (struct task) { .block = block, .dt = block->count / config->cycles_per_s });
+  }
+}
+
+void preparer_feedback(struct preparer *preparer, double cycles_per_s, double lag)
+{
+  atomic_store_explicit(&preparer->cycles_per_s, cycles_per_s, memory_order_relaxed);
+  atomic_store_explicit(&preparer->lag, lag, memory_order_relaxed);
+}
+
+void *preparer_task(void *data)
+{
+  struct preparer *preparer = data;
+  while (!worker_abort)
+  {
+    if (!ringbuffer_wait(preparer->tasks, 1.0)) continue;
+
+    struct task task = ringbuffer_take(preparer->tasks);
+    if (task.quit || task.waveform)
+    {
+      ringbuffer_queue(preparer->blocks, task);
+      if (task.quit) break;
+      continue;
+    }
+    prepare_move(preparer, task.from, task.to, task.dt);
+  }
+  return NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef RASPBERRYEGG_PREPARE_H
+#define RASPBERRYEGG_PREPARE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "motion.h"
+#include "ringbuffer.h"
+#include "util.h"
+#include "words.h"
+
+// moves worked out ahead of the worker (-P). a helper thread takes the producer's tasks, runs the
+// motion math and frame_words() on them into a pool of preallocated blocks, and queues the blocks
+// for the worker, which then only writes the words out. waveforms and the quit task go through as-is.
+
+// a run of whole frames of one move, but for the move's last frame
+struct frame_block
+{
+  int count; // words
+  bool first, last; // of its move
+  float dt; // of the move
+  int cycles; // of the move
+  coordinate at; // where the move is at the end of the block
+  struct frame_word *words; // WORDS_ALIGN aligned, room for the preparer's block_frames frames
+};
+
+struct preparer
+{
+  struct eggbot_config config; // the worker's, at the loop rate it last reported
+  struct task_ring_buffer *tasks; // from the producer
+  struct task_ring_buffer *blocks; // to the worker
+  // the worker holds one block and the queue the rest, so the pool has two more than the queue
+  struct frame_block *pool;
+  size_t pool_size, next;
+  int block_frames;
+  struct frame *frames; // block_frames of them, for working out a block
+  double stream_s; // s of frames prepared so far; the servo pwm runs off this
+
+  // written by the worker at the end of each move
+  _Alignas(RINGBUFFER_CACHE_LINE) _Atomic double cycles_per_s;
+  _Atomic double lag; // s the move ended after its deadline
+};
+
+// for the worker running `config`, taking the producer's tasks from `tasks`
+struct preparer *preparer_create(const struct eggbot_config *config, struct task_ring_buffer *tasks);
+
+// the helper thread: prepares tasks until the quit task, which it passes on
+void *preparer_task(void *data);
+
+// split the move into blocks and queue them for the worker
+void prepare_move(struct preparer *preparer, coordinate from, coordinate to, float dt);
+
+// the worker's loop rate and lag after a move, for sizing the moves still to come
+void preparer_feedback(struct preparer *preparer, double cycles_per_s, double lag);
+
+#endif
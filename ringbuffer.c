@@ -1,39 +1,214 @@
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "ringbuffer.h"
 
-struct task_ring_buffer *ringbuffer_init(size_t length)
+static void futex(atomic_uint *word, int op, unsigned int value, const struct timespec *timeout)
+{
+  syscall(SYS_futex, (unsigned int*) word, op, value, timeout, NULL, 0);
+}
+
+struct task_ring_buffer *ringbuffer_init(size_t length, double low_water, double high_water)
 {
-  struct task_ring_buffer *res = malloc(sizeof(struct task_ring_buffer));
-  *res = (struct task_ring_buffer) {
-    .reading = 0,
-    .writing = 0,
-    .length = length,
-    .data = malloc(sizeof(struct task) * length)
-  };
+  length = next_pow2(length);
+  struct task_ring_buffer *res = aligned_alloc(RINGBUFFER_CACHE_LINE, sizeof(struct task_ring_buffer));
+  atomic_init(&res->writing, 0);
+  res->reading_cache = 0;
+  res->queued_total = 0;
+  res->taken_cache = 0;
+  res->low_water = low_water;
+  res->high_water = high_water;
+  atomic_init(&res->reading, 0);
+  res->writing_cache = 0;
+  atomic_init(&res->space_futex, 0);
+  atomic_init(&res->producer_waiting, false);
+  atomic_init(&res->data_futex, 0);
+  atomic_init(&res->consumer_waiting, false);
+  res->length = length;
+  res->mask = length - 1;
+  res->data = malloc(sizeof(struct task) * length);
   return res;
 }
 
+// free slots as seen by the producer; only looks at the consumer's index once the cached one runs out
+static size_t ringbuffer_space(struct task_ring_buffer *buffer, size_t writing)
+{
+  size_t space = buffer->length - (writing - buffer->reading_cache);
+  if (space == 0)
+  {
+    buffer->reading_cache = atomic_load_explicit(&buffer->reading, memory_order_acquire);
+    space = buffer->length - (writing - buffer->reading_cache);
+  }
+  return space;
+}
+
+static size_t ringbuffer_wait_space(struct task_ring_buffer *buffer, size_t writing)
+{
+  size_t space;
+  while ((space = ringbuffer_space(buffer, writing)) == 0)
+  {
+    unsigned int seq = atomic_load(&buffer->space_futex);
+    atomic_store(&buffer->producer_waiting, true);
+    // the consumer may have freed a slot before it could see us waiting
+    buffer->reading_cache = atomic_load(&buffer->reading);
+    if (buffer->length - (writing - buffer->reading_cache) == 0)
+    {
+      futex(&buffer->space_futex, FUTEX_WAIT_PRIVATE, seq, NULL);
+    }
+    atomic_store_explicit(&buffer->producer_waiting, false, memory_order_relaxed);
+  }
+  return space;
+}
+
+double ringbuffer_queued_time(struct task_ring_buffer *buffer)
+{
+  size_t writing = atomic_load_explicit(&buffer->writing, memory_order_relaxed);
+  size_t reading = atomic_load_explicit(&buffer->reading, memory_order_acquire);
+  if (reading == writing) return 0;
+  // the producer never writes past reading + length, so that slot still holds its task,
+  // even if the consumer has taken it since
+  buffer->reading_cache = reading;
+  buffer->taken_cache = buffer->data[reading & buffer->mask].queued_before;
+  return buffer->queued_total - buffer->taken_cache;
+}
+
+static void ringbuffer_wait_time(struct task_ring_buffer *buffer)
+{
+  // the cached stamp can only make it look fuller, so only look at the consumer's side when it's over
+  if (buffer->queued_total - buffer->taken_cache < buffer->high_water) return;
+
+  double queued;
+  while ((queued = ringbuffer_queued_time(buffer)) >= buffer->high_water)
+  {
+    // the worker plays the queue in real time, so this is about when it's down to the low watermark
+    nap_secs(queued - buffer->low_water);
+  }
+}
+
 void ringbuffer_queue(struct task_ring_buffer *buffer, struct task task)
 {
-  while ((buffer->writing + 1) % buffer->length == buffer->reading % buffer->length)
+  ringbuffer_queue_n(buffer, &task, 1);
+}
+
+void ringbuffer_queue_n(struct task_ring_buffer *buffer, const struct task *tasks, size_t count)
+{
+  size_t writing = atomic_load_explicit(&buffer->writing, memory_order_relaxed);
+  while (count > 0)
+  {
+    ringbuffer_wait_time(buffer);
+    size_t batch = ringbuffer_wait_space(buffer, writing);
+    if (batch > count) batch = count;
+
+    for (size_t i = 0; i < batch; i++)
+    {
+      struct task *slot = &buffer->data[(writing + i) & buffer->mask];
+      *slot = tasks[i];
+      slot->queued_before = buffer->queued_total;
+      buffer->queued_total += tasks[i].dt;
+    }
+    writing += batch;
+    atomic_store_explicit(&buffer->writing, writing, memory_order_release);
+    // pairs with the consumer announcing itself before it rechecks `writing`
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&buffer->consumer_waiting, memory_order_relaxed))
+    {
+      atomic_fetch_add(&buffer->data_futex, 1);
+      futex(&buffer->data_futex, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+
+    tasks += batch;
+    count -= batch;
+  }
+}
+
+// queued tasks as seen by the consumer; only looks at the producer's index once the cached one runs out
+static size_t ringbuffer_available(struct task_ring_buffer *buffer, size_t reading)
+{
+  size_t available = buffer->writing_cache - reading;
+  if (available == 0)
+  {
+    buffer->writing_cache = atomic_load_explicit(&buffer->writing, memory_order_acquire);
+    available = buffer->writing_cache - reading;
+  }
+  return available;
+}
+
+static void ringbuffer_release(struct task_ring_buffer *buffer, size_t reading)
+{
+  atomic_store_explicit(&buffer->reading, reading, memory_order_release);
+  // pairs with the producer announcing itself before it rechecks `reading`
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&buffer->producer_waiting, memory_order_relaxed))
   {
-    nap(10);
+    atomic_fetch_add(&buffer->space_futex, 1);
+    futex(&buffer->space_futex, FUTEX_WAKE_PRIVATE, 1, NULL);
   }
-  buffer->data[buffer->writing] = task;
-  atomic_thread_fence(memory_order_release);
-  buffer->writing = (buffer->writing + 1) % buffer->length;
 }
 
 bool ringbuffer_peek(struct task_ring_buffer *buffer)
 {
-  atomic_thread_fence(memory_order_acquire);
-  return buffer->reading != buffer->writing;
+  size_t reading = atomic_load_explicit(&buffer->reading, memory_order_relaxed);
+  return ringbuffer_available(buffer, reading) > 0;
+}
+
+bool ringbuffer_wait(struct task_ring_buffer *buffer, double timeout)
+{
+  if (ringbuffer_peek(buffer)) return true;
+  if (timeout <= 0) return false;
+
+  unsigned int seq = atomic_load(&buffer->data_futex);
+  atomic_store(&buffer->consumer_waiting, true);
+  atomic_thread_fence(memory_order_seq_cst);
+  // the producer may have queued a task before it could see us waiting
+  if (!ringbuffer_peek(buffer))
+  {
+    struct timespec spec = { .tv_sec = (time_t) timeout, .tv_nsec = (long) ((timeout - (time_t) timeout) * 1e9) };
+    futex(&buffer->data_futex, FUTEX_WAIT_PRIVATE, seq, &spec);
+  }
+  atomic_store_explicit(&buffer->consumer_waiting, false, memory_order_relaxed);
+  return ringbuffer_peek(buffer);
+}
+
+bool ringbuffer_spin(struct task_ring_buffer *buffer, double timeout)
+{
+  double deadline = secs() + timeout;
+  while (!ringbuffer_peek(buffer))
+  {
+    if (secs() >= deadline) return false;
+  }
+  return true;
+}
+
+size_t ringbuffer_fill(struct task_ring_buffer *buffer)
+{
+  size_t reading = atomic_load_explicit(&buffer->reading, memory_order_relaxed);
+  buffer->writing_cache = atomic_load_explicit(&buffer->writing, memory_order_acquire);
+  return buffer->writing_cache - reading;
 }
 
 struct task ringbuffer_take(struct task_ring_buffer *buffer)
 {
-  atomic_thread_fence(memory_order_acquire);
-  struct task task = buffer->data[buffer->reading];
-  atomic_thread_fence(memory_order_release);
-  buffer->reading = (buffer->reading + 1) % buffer->length;
+  size_t reading = atomic_load_explicit(&buffer->reading, memory_order_relaxed);
+  struct task task = buffer->data[reading & buffer->mask];
+  ringbuffer_release(buffer, reading + 1);
   return task;
 }
+
+size_t ringbuffer_take_n(struct task_ring_buffer *buffer, struct task *tasks, size_t count)
+{
+  size_t reading = atomic_load_explicit(&buffer->reading, memory_order_relaxed);
+  size_t available = ringbuffer_available(buffer, reading);
+  if (count > available) count = available;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    tasks[i] = buffer->data[(reading + i) & buffer->mask];
+  }
+  if (count > 0)
+  {
+    ringbuffer_release(buffer, reading + count);
+  }
+  return count;
+}
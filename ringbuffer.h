@@ -7,28 +7,79 @@
 
 #include "util.h"
 
+#define RINGBUFFER_CACHE_LINE 64
+
+struct waveform;
+struct frame_block;
+
 struct task
 {
   bool quit; // exit when this task is found
+  struct waveform *waveform; // if set, replay this compiled job instead of moving from -> to
+  struct frame_block *block; // if set, write out these prepared words instead (-P)
   coordinate from, to;
-  float dt;
+  float dt; // for a waveform, how long it plays
+  double queued_before; // s of motion queued ahead of this task, stamped by the ring buffer
 };
 
+// single producer, single consumer. each side's index lives on its own cache line
+// with a cached copy of the other side's, so neither touches the other's line until it has to.
+// indices run freely and are masked into the power-of-two sized data array.
+// the producer also keeps the queue to a span of motion time: once `high_water` s are queued it
+// waits until the worker is down to `low_water`. that's all worked out on the producer's side
+// from the tasks' own time stamps, so the consumer doesn't pay for it.
 struct task_ring_buffer
 {
-  size_t reading; // index of read pointer
-  size_t writing; // index of write pointer
+  // written by the producer
+  _Alignas(RINGBUFFER_CACHE_LINE) atomic_size_t writing; // index of write pointer
+  size_t reading_cache;
+  double queued_total; // s of motion queued so far
+  double taken_cache; // queued_before of the task at reading_cache, as of the last look
+  double low_water, high_water;
+
+  // written by the consumer
+  _Alignas(RINGBUFFER_CACHE_LINE) atomic_size_t reading; // index of read pointer
+  size_t writing_cache;
 
-  size_t length; // immutable
+  // futex the producer sleeps on while the buffer is full; bumped by the consumer
+  _Alignas(RINGBUFFER_CACHE_LINE) atomic_uint space_futex;
+  atomic_bool producer_waiting;
+
+  // futex the consumer sleeps on in ringbuffer_wait(); bumped by the producer
+  _Alignas(RINGBUFFER_CACHE_LINE) atomic_uint data_futex;
+  atomic_bool consumer_waiting;
+
+  _Alignas(RINGBUFFER_CACHE_LINE) size_t length; // immutable, power of two
+  size_t mask;
   struct task *data;
 };
 
-struct task_ring_buffer *ringbuffer_init(size_t length);
+// `length` is rounded up to a power of two. watermarks are in s of motion; INFINITY bounds the queue by length only
+struct task_ring_buffer *ringbuffer_init(size_t length, double low_water, double high_water);
 
+// blocks while the buffer is full or over the high watermark
 void ringbuffer_queue(struct task_ring_buffer *buffer, struct task task);
 
+// queue all `count` tasks, blocking whenever the buffer is full or over the high watermark
+void ringbuffer_queue_n(struct task_ring_buffer *buffer, const struct task *tasks, size_t count);
+
+// s of motion queued and not taken yet, as seen by the producer
+double ringbuffer_queued_time(struct task_ring_buffer *buffer);
+
 bool ringbuffer_peek(struct task_ring_buffer *buffer);
 
+// sleep up to `timeout` s for a task to be queued; returns whether there is one
+bool ringbuffer_wait(struct task_ring_buffer *buffer, double timeout);
+
+// like ringbuffer_wait(), but busy-waits: for short waits on a core that mustn't sleep
+bool ringbuffer_spin(struct task_ring_buffer *buffer, double timeout);
+
+// number of queued tasks, as seen by the consumer
+size_t ringbuffer_fill(struct task_ring_buffer *buffer);
+
 struct task ringbuffer_take(struct task_ring_buffer *buffer);
 
+// take up to `count` tasks without blocking; returns how many were taken
+size_t ringbuffer_take_n(struct task_ring_buffer *buffer, struct task *tasks, size_t count);
+
 #endif
@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "rt.h"
+
+// highest cpu in a kernel cpu list file like "1-3,5", or -1 if it's missing or empty
+static int cpulist_last(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) return -1;
+
+  int last = -1, cpu;
+  char separator;
+  while (fscanf(file, "%d%c", &cpu, &separator) >= 1)
+  {
+    if (cpu > last) last = cpu;
+    if (separator == '\n') break;
+  }
+  fclose(file);
+  return last;
+}
+
+int rt_pick_core(const struct rt_config *config)
+{
+  if (config->core >= 0) return config->core;
+
+  int core = cpulist_last("/sys/devices/system/cpu/isolated");
+  if (core < 0) core = cpulist_last("/sys/devices/system/cpu/nohz_full");
+  if (core < 0)
+  {
+    // core 3 on a pi
+    core = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  }
+  return core;
+}
+
+// device irqs that have fired on `core`; the local timer and ipis can't be moved, so they don't count
+static void rt_check_irqs(int core)
+{
+  FILE *file = fopen("/proc/interrupts", "r");
+  if (!file) return;
+
+  // only online cpus get a column
+  char line[1024], name[16];
+  int column = -1, columns = 0;
+  snprintf(name, sizeof(name), "CPU%i", core);
+  if (fgets(line, sizeof(line), file))
+  {
+    for (char *word = strtok(line, " \n"); word; word = strtok(NULL, " \n"), columns++)
+    {
+      if (strcmp(word, name) == 0) column = columns;
+    }
+  }
+
+  int shared = 0;
+  char irqs[128] = "";
+  while (column >= 0 && fgets(line, sizeof(line), file))
+  {
+    char *cursor;
+    long irq = strtol(line, &cursor, 10);
+    if (cursor == line || *cursor != ':') continue;
+    cursor++;
+
+    unsigned long long count = 0;
+    for (int i = 0; i <= column; i++)
+    {
+      count = strtoull(cursor, &cursor, 10);
+    }
+    if (count == 0) continue;
+
+    if (shared++ < 8)
+    {
+      snprintf(irqs + strlen(irqs), sizeof(irqs) - strlen(irqs), " %li", irq);
+    }
+  }
+  fclose(file);
+
+  if (shared > 0)
+  {
+    fprintf(
+      stderr, "warn: cpu %i shares %i irqs with the worker (%s%s); move them with /proc/irq/*/smp_affinity\n",
+      core, shared, irqs + 1, shared > 8 ? " ..." : ""
+    );
+  }
+}
+
+// the kernel only lets SCHED_FIFO threads run for part of each period by default
+static void rt_check_throttling()
+{
+  long runtime = 0, period = 0;
+  FILE *file = fopen("/proc/sys/kernel/sched_rt_runtime_us", "r");
+  if (file)
+  {
+    if (fscanf(file, "%li", &runtime) != 1) runtime = -1;
+    fclose(file);
+  }
+  file = fopen("/proc/sys/kernel/sched_rt_period_us", "r");
+  if (file)
+  {
+    if (fscanf(file, "%li", &period) != 1) period = 0;
+    fclose(file);
+  }
+  if (runtime >= 0 && period > 0 && runtime < period)
+  {
+    fprintf(
+      stderr, "warn: real-time threads are throttled to %li of every %li ms, the worker will stall for the rest;"
+      " on an isolated core, write -1 to /proc/sys/kernel/sched_rt_runtime_us\n",
+      runtime / 1000, period / 1000
+    );
+  }
+}
+
+static void rt_lock_memory()
+{
+  // under a finite limit, locking future pages would make allocations fail once it's reached
+  int flags = MCL_CURRENT;
+  struct rlimit limit;
+  if (geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY))
+  {
+    flags |= MCL_FUTURE;
+  }
+  if (mlockall(flags) != 0)
+  {
+    fprintf(stderr, "warn: can't lock memory (%s), page faults may stall the worker\n", strerror(errno));
+  }
+}
+
+// touch the stack the worker will run on, so it doesn't fault in while bit-banging
+static void rt_prefault_stack()
+{
+  volatile char stack[RT_STACK_PREFAULT];
+  long page = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < sizeof(stack); i += page)
+  {
+    stack[i] = 0;
+  }
+}
+
+void rt_enter(const struct rt_config *config)
+{
+  int core = rt_pick_core(config);
+  cpu_set_t cpuset;
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  if (res != 0 && config->pin_required)
+  {
+    fprintf(stderr, "pthread_setaffinity_np() failed for cpu %i: %s\n", core, strerror(res));
+    abort();
+  }
+  else if (res != 0)
+  {
+    fprintf(stderr, "warn: can't pin the worker to cpu %i (%s), running unpinned\n", core, strerror(res));
+  }
+  else
+  {
+    rt_check_irqs(core);
+  }
+
+  if (!config->enabled) return;
+
+  rt_lock_memory();
+  rt_prefault_stack();
+
+  struct sched_param param = { .sched_priority = config->priority };
+  res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (res != 0)
+  {
+    fprintf(stderr, "warn: can't run the worker on SCHED_FIFO (%s), staying at normal priority\n", strerror(res));
+    return;
+  }
+  rt_check_throttling();
+  if (sysconf(_SC_NPROCESSORS_ONLN) == 1)
+  {
+    fprintf(stderr, "warn: only one cpu, the worker will starve the eggcode reader and underrun\n");
+  }
+}
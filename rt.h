@@ -0,0 +1,24 @@
+#ifndef RASPBERRYEGG_RT_H
+#define RASPBERRYEGG_RT_H
+
+#include <stdbool.h>
+
+// puts the worker thread on its own core, and with `enabled` on SCHED_FIFO with its memory locked.
+// all of it is best effort: without the privileges for a step, it warns and carries on,
+// so the same build runs in a container.
+
+struct rt_config
+{
+  bool enabled; // SCHED_FIFO and locked memory; otherwise just pinning
+  int priority; // SCHED_FIFO, 1 to 99
+  int core; // -1 to pick one with rt_pick_core()
+  bool pin_required; // abort instead of running unpinned
+};
+
+// config->core if set, else the highest isolcpus/nohz_full cpu, else the last online one
+int rt_pick_core(const struct rt_config *config);
+
+// call on the worker thread, once everything it touches is allocated
+void rt_enter(const struct rt_config *config);
+
+#endif
@@ -0,0 +1,241 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "simulate.h"
+
+void simulate_init(struct simulation *sim, struct eggbot_config config, struct planner_config limits, const char *trajectory)
+{
+  *sim = (struct simulation) {
+    .config = config,
+    .limits = limits,
+  };
+  if (trajectory)
+  {
+    sim->trajectory = fopen(trajectory, "w");
+    if (!sim->trajectory)
+    {
+      perror("can't create trajectory file: ");
+      abort();
+    }
+    fprintf(sim->trajectory, "# t egg pen servo\n");
+  }
+}
+
+static void sample(struct simulation *sim, double t, double egg, double pen, double servo)
+{
+  fprintf(sim->trajectory, "%.3f %.4f %.4f %.3f\n", t, egg, pen, servo);
+}
+
+// the move as the steppers run it: egg(t) = egg0 + v0 t + a/2 t^2, the servo blended linearly
+static void sample_move(struct simulation *sim, coordinate from, coordinate to, double dt, double egg_accel, double pen_accel)
+{
+  double start = sim->total.time;
+  for (; sim->next_sample < start + dt; sim->next_sample += SIMULATE_SAMPLE_PERIOD)
+  {
+    double t = sim->next_sample - start;
+    sample(
+      sim, sim->next_sample,
+      unitf(from.egg) + from.egg_speed * t + egg_accel / 2 * t * t,
+      unitf(from.pen) + from.pen_speed * t + pen_accel / 2 * t * t,
+      blend(dt > 0 ? t / dt : 1, from.servo, to.servo)
+    );
+  }
+}
+
+// print why the move is flagged, for the first SIMULATE_MAX_WARNINGS moves of the file
+static void flag(struct simulation *sim, bool *flagged, const char *fmt, ...)
+{
+  if (!*flagged) sim->file.flagged++;
+  *flagged = true;
+  if (sim->file.flagged > SIMULATE_MAX_WARNINGS) return;
+
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "warn: %s:%i: ", sim->filename, sim->line);
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+static double maxd(double a, double b)
+{
+  return a > b ? a : b;
+}
+
+void simulate_task(struct simulation *sim, coordinate from, coordinate to, float dt)
+{
+  if (dt < 0)
+  {
+    fprintf(stderr, "Time travel detected!\n");
+    abort();
+  }
+
+  struct eggbot_config *config = &sim->config;
+  int length = config->pwm_config.length_pow2;
+  struct motion motion;
+  motion_init(&motion, config, from, to, dt, (int) (dt * config->cycles_per_s), false);
+
+  // the largest phase advance per frame, as step() would see it. more than a quarter of a unit
+  // (a full step) between frames and the windings skip past the rotor
+  double egg_frame = 0, pen_frame = 0;
+  for (int i = 0; i < motion.cycles; i += length)
+  {
+    egg_frame = maxd(egg_frame, fabs((int64_t) motion.egg_velocity * 0x1p-64));
+    pen_frame = maxd(pen_frame, fabs((int64_t) motion.pen_velocity * 0x1p-64));
+
+    struct frame frame;
+    motion_frame(&motion, config, i, sim->total.time + i / config->cycles_per_s, &frame);
+    sim->file.frames++;
+  }
+
+  double egg_accel = move_accel(unit_diff_f(from.egg, to.egg), dt, from.egg_speed);
+  double pen_accel = move_accel(unit_diff_f(from.pen, to.pen), dt, from.pen_speed);
+  // speed changes linearly over the move, so it peaks at one end.
+  // past half a unit per frame the accumulators alias, so check the frames against these too
+  double egg_speed = maxd(fabs(from.egg_speed), fabs(from.egg_speed + egg_accel * dt));
+  double pen_speed = maxd(fabs(from.pen_speed), fabs(from.pen_speed + pen_accel * dt));
+  double frame_s = length / config->cycles_per_s;
+  egg_frame = maxd(egg_frame, egg_speed * frame_s);
+  pen_frame = maxd(pen_frame, pen_speed * frame_s);
+
+  struct simulation_peaks *peaks = &sim->file;
+  const struct planner_config *limits = &sim->limits;
+  bool flagged = false;
+  if (egg_speed > limits->egg_max_speed * SIMULATE_TOLERANCE || pen_speed > limits->pen_max_speed * SIMULATE_TOLERANCE)
+  {
+    peaks->over_speed++;
+    flag(
+      sim, &flagged, "egg at %.1f units/s, pen at %.1f, over the limit of %.1f and %.1f",
+      egg_speed, pen_speed, limits->egg_max_speed, limits->pen_max_speed
+    );
+  }
+  if (fabs(egg_accel) > limits->egg_accel * SIMULATE_TOLERANCE || fabs(pen_accel) > limits->pen_accel * SIMULATE_TOLERANCE)
+  {
+    peaks->over_accel++;
+    flag(
+      sim, &flagged, "egg accelerating at %.0f units/s^2, pen at %.0f, over the limit of %.0f and %.0f",
+      fabs(egg_accel), fabs(pen_accel), limits->egg_accel, limits->pen_accel
+    );
+  }
+  if (egg_frame > 0.25 || pen_frame > 0.25)
+  {
+    peaks->over_frame++;
+    flag(
+      sim, &flagged, "egg moves %.2f units per pwm frame, pen %.2f; the windings can't follow more than 0.25",
+      egg_frame, pen_frame
+    );
+  }
+  if (sim->moving
+    && (fabs(from.egg_speed - sim->last.egg_speed) > limits->egg_jump * SIMULATE_TOLERANCE
+      || fabs(from.pen_speed - sim->last.pen_speed) > limits->pen_jump * SIMULATE_TOLERANCE))
+  {
+    peaks->over_jump++;
+  }
+
+  peaks->egg_speed = maxd(peaks->egg_speed, egg_speed);
+  peaks->pen_speed = maxd(peaks->pen_speed, pen_speed);
+  peaks->egg_accel = maxd(peaks->egg_accel, fabs(egg_accel));
+  peaks->pen_accel = maxd(peaks->pen_accel, fabs(pen_accel));
+  peaks->moves++;
+
+  if (sim->trajectory)
+  {
+    sample_move(sim, from, to, dt, egg_accel, pen_accel);
+  }
+  peaks->time += dt;
+  sim->total.time += dt;
+
+  sim->moving = true;
+  sim->last = to;
+  sim->last.egg_speed = from.egg_speed + egg_accel * dt;
+  sim->last.pen_speed = from.pen_speed + pen_accel * dt;
+}
+
+void simulate_skip(struct simulation *sim, coordinate to, double dt)
+{
+  if (sim->trajectory)
+  {
+    to.egg_speed = to.pen_speed = 0;
+    sample_move(sim, to, to, dt, 0, 0);
+  }
+  sim->file.time += dt;
+  sim->total.time += dt;
+  sim->moving = false;
+  sim->last = to;
+}
+
+void simulate_file_start(struct simulation *sim, const char *filename)
+{
+  sim->filename = filename;
+  sim->line = 0;
+  sim->file = (struct simulation_peaks) { 0 };
+  // the pen is changed in between, so the steppers start the file at rest
+  sim->moving = false;
+}
+
+// h:mm:ss.s
+static void print_duration(double s)
+{
+  int minutes = (int) (s / 60);
+  printf("%i:%02i:%04.1f", minutes / 60, minutes % 60, s - minutes * 60);
+}
+
+static void print_peaks(const struct simulation_peaks *peaks)
+{
+  print_duration(peaks->time);
+  printf(" (%.1f s), %llu moves\n", peaks->time, (unsigned long long) peaks->moves);
+  printf(
+    "  egg up to %.1f units/s and %.0f units/s^2, pen up to %.1f units/s and %.0f units/s^2\n",
+    peaks->egg_speed, peaks->egg_accel, peaks->pen_speed, peaks->pen_accel
+  );
+  if (peaks->flagged)
+  {
+    printf(
+      "  %llu moves no stepper follows: %llu too fast, %llu accelerating too hard, %llu too fast for the pwm rate\n",
+      (unsigned long long) peaks->flagged, (unsigned long long) peaks->over_speed,
+      (unsigned long long) peaks->over_accel, (unsigned long long) peaks->over_frame
+    );
+  }
+  if (peaks->over_jump)
+  {
+    printf("  %llu instant speed changes over the planner's limit; -p ramps them\n", (unsigned long long) peaks->over_jump);
+  }
+}
+
+void simulate_file_end(struct simulation *sim)
+{
+  struct simulation_peaks *file = &sim->file, *total = &sim->total;
+  printf("%s: ", sim->filename);
+  print_peaks(file);
+
+  // total.time is kept up to date by the moves themselves
+  total->egg_speed = maxd(total->egg_speed, file->egg_speed);
+  total->pen_speed = maxd(total->pen_speed, file->pen_speed);
+  total->egg_accel = maxd(total->egg_accel, file->egg_accel);
+  total->pen_accel = maxd(total->pen_accel, file->pen_accel);
+  total->moves += file->moves;
+  total->frames += file->frames;
+  total->over_speed += file->over_speed;
+  total->over_accel += file->over_accel;
+  total->over_frame += file->over_frame;
+  total->over_jump += file->over_jump;
+  total->flagged += file->flagged;
+}
+
+uint64_t simulate_finish(struct simulation *sim, int files, double wall_s)
+{
+  printf("total for %i files: ", files);
+  print_peaks(&sim->total);
+  printf(
+    "simulated %llu pwm frames in %.3f s, %.0fx real time\n",
+    (unsigned long long) sim->total.frames, wall_s, wall_s > 0 ? sim->total.time / wall_s : 0
+  );
+  if (sim->trajectory && fclose(sim->trajectory) != 0)
+  {
+    perror("can't write trajectory file: ");
+    abort();
+  }
+  return sim->total.flagged;
+}
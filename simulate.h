@@ -0,0 +1,57 @@
+#ifndef RASPBERRYEGG_SIMULATE_H
+#define RASPBERRYEGG_SIMULATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "motion.h"
+#include "planner.h"
+#include "util.h"
+
+// runs moves through the same motion math as step(), frame by frame, but without the gpios or
+// keeping to real time: how long a job takes, how fast and hard it drives the steppers, and
+// which of its moves no stepper could follow.
+
+struct simulation_peaks
+{
+  double time; // s
+  double egg_speed, pen_speed; // units/s
+  double egg_accel, pen_accel; // units/s^2
+  uint64_t moves, frames;
+  // moves over the planner limits. unplanned eggcode changes speed instantly all the time,
+  // so jumps are only counted; the rest no stepper can follow and get the move flagged
+  uint64_t over_speed, over_accel, over_frame, over_jump;
+  uint64_t flagged;
+};
+
+struct simulation
+{
+  struct eggbot_config config; // cycles_per_s and the frame length set the simulated frame rate
+  struct planner_config limits;
+  FILE *trajectory; // if set, gets "t egg pen servo" every SIMULATE_SAMPLE_PERIOD s
+  double next_sample;
+  const char *filename; // of the job being simulated
+  int line; // the eggcode had been read up to here when the current move was queued
+  bool moving; // false before the first move, and after simulate_skip()
+  coordinate last; // where the previous move ended, with its speed there
+  struct simulation_peaks file, total;
+};
+
+// `trajectory` is a file name or NULL
+void simulate_init(struct simulation *sim, struct eggbot_config config, struct planner_config limits, const char *trajectory);
+
+void simulate_task(struct simulation *sim, coordinate from, coordinate to, float dt);
+
+// pass `dt` s without moving; the job ends up at `to`
+void simulate_skip(struct simulation *sim, coordinate to, double dt);
+
+void simulate_file_start(struct simulation *sim, const char *filename);
+
+// print the stats of the file
+void simulate_file_end(struct simulation *sim);
+
+// print the totals and close the trajectory; returns how many moves were flagged
+uint64_t simulate_finish(struct simulation *sim, int files, double wall_s);
+
+#endif
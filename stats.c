@@ -0,0 +1,201 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "util.h"
+
+_Thread_local struct stats *worker_stats = NULL;
+static struct stats *stats_created = NULL;
+static bool stats_shared = false;
+
+struct stats *stats_create(double cycles_per_s, double frame_budget)
+{
+  struct stats *stats = NULL;
+  int fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd >= 0 && ftruncate(fd, sizeof(struct stats)) == 0)
+  {
+    stats = mmap(NULL, sizeof(struct stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) stats = NULL;
+  }
+  if (fd >= 0) close(fd);
+
+  stats_shared = stats != NULL;
+  if (!stats)
+  {
+    fprintf(stderr, "warn: can't share stats in %s, -S won't see them\n", STATS_SHM_NAME);
+    stats = malloc(sizeof(struct stats));
+  }
+
+  memset(stats, 0, sizeof(struct stats));
+  stats->version = STATS_VERSION;
+  stats->pid = getpid();
+  stats->started = secs();
+  stats->cycles_per_s = cycles_per_s;
+  stats->frame_budget = frame_budget;
+  atomic_thread_fence(memory_order_release);
+  stats->magic = STATS_MAGIC;
+  stats_created = stats;
+  return stats;
+}
+
+static void stats_begin(struct stats *stats)
+{
+  atomic_fetch_add_explicit(&stats->seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void stats_end(struct stats *stats)
+{
+  atomic_fetch_add_explicit(&stats->seq, 1, memory_order_release);
+}
+
+void stats_segment(double planned_s, double actual_s, const struct frame_stats *frame_stats, uint64_t cycles)
+{
+  struct stats *stats = worker_stats;
+  if (!stats) return;
+
+  stats_begin(stats);
+  stats->segments++;
+  stats->planned_s += planned_s;
+  stats->actual_s += actual_s;
+  stats->last_planned_s = planned_s;
+  stats->last_actual_s = actual_s;
+  if (actual_s - planned_s > stats->worst_segment_overrun_s)
+  {
+    stats->worst_segment_overrun_s = actual_s - planned_s;
+  }
+
+  stats->frames += frame_stats->frames;
+  if (frame_stats->max_frame_s > stats->max_frame_s)
+  {
+    stats->max_frame_s = frame_stats->max_frame_s;
+  }
+  for (int i = 0; i < STATS_FRAME_BUCKETS; i++)
+  {
+    stats->frame_histogram[i] += frame_stats->histogram[i];
+  }
+
+  stats->cycles = cycles;
+  stats->cycles_wall_s = secs() - stats->started;
+  stats_end(stats);
+}
+
+void stats_underrun(double duration_s)
+{
+  struct stats *stats = worker_stats;
+  if (!stats) return;
+
+  stats_begin(stats);
+  stats->underruns++;
+  stats->underrun_s += duration_s;
+  stats_end(stats);
+}
+
+void stats_queue(size_t fill)
+{
+  struct stats *stats = worker_stats;
+  if (!stats) return;
+
+  int bucket = 0;
+  while (bucket < STATS_FILL_BUCKETS - 1 && (1u << bucket) <= fill) bucket++;
+
+  stats_begin(stats);
+  stats->queue_fill = fill;
+  stats->fill_histogram[bucket]++;
+  stats_end(stats);
+}
+
+void stats_close()
+{
+  if (stats_shared)
+  {
+    munmap(stats_created, sizeof(struct stats));
+    shm_unlink(STATS_SHM_NAME);
+  }
+  else
+  {
+    free(stats_created);
+  }
+  stats_created = NULL;
+}
+
+// consistent copy of what the worker wrote
+static void stats_read(const struct stats *stats, struct stats *copy)
+{
+  while (true)
+  {
+    uint32_t seq = atomic_load_explicit(&stats->seq, memory_order_acquire);
+    if (seq % 2) continue;
+    memcpy(copy, (const void*) stats, sizeof(struct stats));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&stats->seq, memory_order_relaxed) == seq) return;
+  }
+}
+
+static void stats_print(const struct stats *stats)
+{
+  static const char *frame_labels[STATS_FRAME_BUCKETS] = { "<0.9x", "0.9-1.1x", "1.1-1.5x", "1.5-2x", "2-4x", ">4x" };
+
+  double uptime = secs() - stats->started;
+  // positive: the cycle counter says more time passed than really did, ie. the loop runs fast
+  double drift = stats->cycles / stats->cycles_per_s - stats->cycles_wall_s;
+
+  printf("pid %i, up %.1f s\n", stats->pid, uptime);
+  printf("  segments %llu: planned %.3f s, took %.3f s (%+.3f s), worst %+.3f ms\n",
+    (unsigned long long) stats->segments, stats->planned_s, stats->actual_s,
+    stats->actual_s - stats->planned_s, stats->worst_segment_overrun_s * 1e3);
+  printf("  last segment: planned %.3f ms, took %.3f ms\n", stats->last_planned_s * 1e3, stats->last_actual_s * 1e3);
+  printf("  frames %llu, budget %.1f us, max %.1f us (%+.1f us over)\n",
+    (unsigned long long) stats->frames, stats->frame_budget * 1e6, stats->max_frame_s * 1e6,
+    (stats->max_frame_s - stats->frame_budget) * 1e6);
+  for (int i = 0; i < STATS_FRAME_BUCKETS; i++)
+  {
+    if (!stats->frame_histogram[i]) continue;
+    printf("    %8s %7.3f%%\n", frame_labels[i], 100.0 * stats->frame_histogram[i] / stats->frames);
+  }
+  printf("  underruns %llu, %.3f s idle\n", (unsigned long long) stats->underruns, stats->underrun_s);
+  printf("  queue fill %llu; over time:", (unsigned long long) stats->queue_fill);
+  for (int i = 0; i < STATS_FILL_BUCKETS; i++)
+  {
+    if (!stats->fill_histogram[i]) continue;
+    printf(" %u+: %llu", i ? 1u << (i - 1) : 0, (unsigned long long) stats->fill_histogram[i]);
+  }
+  printf("\n");
+  printf("  cycle counter drift %+.3f ms over %.1f s\n", drift * 1e3, stats->cycles_wall_s);
+}
+
+int stats_show()
+{
+  int fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+  if (fd < 0)
+  {
+    fprintf(stderr, "no stats at %s, is the driver running?\n", STATS_SHM_NAME);
+    return 1;
+  }
+  const struct stats *stats = mmap(NULL, sizeof(struct stats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED)
+  {
+    fprintf(stderr, "mmap error %p\n", (void*) stats);
+    return 1;
+  }
+  if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION)
+  {
+    fprintf(stderr, "%s is not version %i stats\n", STATS_SHM_NAME, STATS_VERSION);
+    return 1;
+  }
+
+  while (true)
+  {
+    struct stats copy;
+    stats_read(stats, &copy);
+    stats_print(&copy);
+    fflush(stdout);
+    nap(1000);
+  }
+}
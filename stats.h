@@ -0,0 +1,86 @@
+#ifndef RASPBERRYEGG_STATS_H
+#define RASPBERRYEGG_STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// timing counters kept by the worker in shared memory, so `raspberryegg -S` can watch a running print.
+// the worker is the only writer; it bumps `seq` around each update, odd while one is in progress.
+
+#define STATS_SHM_NAME "/raspberryegg-stats"
+#define STATS_MAGIC 0x45474753 // "SGGE"
+#define STATS_VERSION 1
+
+// frame durations, as a fraction of the pwm frame budget
+#define STATS_FRAME_BUCKETS 6
+static const double stats_frame_edges[STATS_FRAME_BUCKETS - 1] = { 0.9, 1.1, 1.5, 2, 4 };
+
+// queue fill levels: 0, 1, 2-3, 4-7, ...
+#define STATS_FILL_BUCKETS 17
+
+struct stats
+{
+  uint32_t magic, version;
+  _Atomic uint32_t seq;
+  int32_t pid;
+  double started; // CLOCK_MONOTONIC s
+  double cycles_per_s;
+  double frame_budget; // s per pwm frame
+
+  // step() calls, planned duration vs wall time
+  uint64_t segments;
+  double planned_s, actual_s;
+  double last_planned_s, last_actual_s;
+  double worst_segment_overrun_s;
+
+  uint64_t frames;
+  double max_frame_s;
+  uint64_t frame_histogram[STATS_FRAME_BUCKETS];
+
+  uint64_t underruns;
+  double underrun_s;
+
+  uint64_t queue_fill; // after the last take
+  uint64_t fill_histogram[STATS_FILL_BUCKETS];
+
+  // global_cycle_counter, and the wall time since `started` when it was sampled
+  uint64_t cycles;
+  double cycles_wall_s;
+};
+
+// per-frame counters step() keeps locally and hands over once per call
+struct frame_stats
+{
+  uint64_t frames;
+  double max_frame_s;
+  uint64_t histogram[STATS_FRAME_BUCKETS];
+};
+
+// the stats this thread's worker keeps; NULL if stats are off, or for all but the first machine
+extern _Thread_local struct stats *worker_stats;
+
+static inline void frame_stats_add(struct frame_stats *frame_stats, double frame_s, double budget)
+{
+  int bucket = 0;
+  while (bucket < STATS_FRAME_BUCKETS - 1 && frame_s >= stats_frame_edges[bucket] * budget) bucket++;
+  frame_stats->histogram[bucket]++;
+  frame_stats->frames++;
+  if (frame_s > frame_stats->max_frame_s) frame_stats->max_frame_s = frame_s;
+}
+
+// in shared memory if possible; the worker thread that keeps them sets worker_stats to this
+struct stats *stats_create(double cycles_per_s, double frame_budget);
+
+void stats_segment(double planned_s, double actual_s, const struct frame_stats *frame_stats, uint64_t cycles);
+
+void stats_underrun(double duration_s);
+
+void stats_queue(size_t fill);
+
+void stats_close();
+
+// print the stats of the running driver every second
+int stats_show();
+
+#endif
@@ -0,0 +1,279 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "pi.h"
+#include "prepare.h"
+#include "stats.h"
+#include "step.h"
+#include "words.h"
+
+bool worker_abort = false;
+_Thread_local uint64_t global_cycle_counter = 0;
+
+// the loop engine's words for the current frame
+static _Thread_local struct frame_word *frame_word_buffer = NULL;
+static _Thread_local int frame_word_capacity = 0;
+
+#ifdef LOG_SERVO_TIMINGS
+int servolog;
+#endif
+
+// when the segment starting at `now` should end
+static double step_deadline(struct step_clock *clock, double now, float dt)
+{
+  if (!clock) return now + dt;
+
+  double end = clock->deadline + dt;
+  // past the slack, stretching or squeezing the move to catch up would be worse than the lost time
+  if (!clock->running || fabs(end - (now + dt)) > dt * DEADLINE_SLACK)
+  {
+    if (clock->running) clock->reanchors++;
+    end = now + dt;
+  }
+  clock->running = true;
+  clock->deadline = end;
+  return end;
+}
+
+// fold the loop rate measured over the last segment into the estimate
+static void step_measure(struct eggbot_config *config, struct step_clock *clock, int cycles, double start, double end)
+{
+  double elapsed = end - start;
+  if (!clock || cycles == 0 || elapsed <= 0 || worker_abort) return;
+
+  clock->measured_cycles_per_s = cycles / elapsed;
+  clock->lag = end - clock->deadline;
+  // the edge engine's cycles are slices of the cycle counter, not loop trips: there's nothing to learn
+  if (config->pwm_config.engine == PWM_ENGINE_EDGE) return;
+  double weight = fmin(1.0, elapsed / RATE_TIME_CONSTANT);
+  config->cycles_per_s += (clock->measured_cycles_per_s - config->cycles_per_s) * weight;
+}
+
+static inline void wait_ticks(double ticks)
+{
+  while (cycle_counter() < ticks) { }
+}
+
+// the frame's edges, as writes from the levels in `*last_bits`, which they update.
+// with `refresh`, every pin is written at the start of the frame, whatever `*last_bits` says.
+static int step_frame_edges(const struct frame *frame, int pwm_len, uint32_t pin_mask, bool refresh, uint32_t *last_bits, struct edge *edges)
+{
+  int count = frame_edges(frame, pwm_len, pin_mask, edges);
+  if (!refresh)
+  {
+    edges[0].set &= ~*last_bits;
+    edges[0].clr &= *last_bits;
+  }
+  for (int e = 0; e < count; e++)
+  {
+    *last_bits = (*last_bits | edges[e].set) & ~edges[e].clr;
+  }
+  return count;
+}
+
+// write only the frame's edges, each at its cycle, timed off cycle_counter() from `frame_ticks`
+static void step_edges(
+  const struct frame *frame, int pwm_len, uint32_t pin_mask, bool refresh, uint32_t *last_bits,
+  double frame_ticks, double ticks_per_cycle, volatile uint32_t *set_reg, volatile uint32_t *clr_reg)
+{
+  struct edge edges[FRAME_MAX_EDGES];
+  int count = step_frame_edges(frame, pwm_len, pin_mask, refresh, last_bits, edges);
+  for (int e = 0; e < count; e++)
+  {
+    if (!(edges[e].set | edges[e].clr)) continue;
+
+    wait_ticks(frame_ticks + edges[e].k * ticks_per_cycle);
+
+#ifdef LOG_SERVO_TIMINGS
+    if ((edges[e].set | edges[e].clr) & frame->bit_servo) dprintf(servolog, "%f\t%i\n", secs(), !!(edges[e].set & frame->bit_servo));
+#endif
+
+    gpio_write_changes(set_reg, clr_reg, edges[e].set, edges[e].clr);
+  }
+}
+
+void step(struct eggbot_config *config, struct step_clock *clock, coordinate from, coordinate to, float dt, bool lock)
+{
+  if (dt < 0)
+  {
+    fprintf(stderr, "Time travel detected!\n");
+    abort();
+  }
+
+  double start = secs(), last_frame = start;
+  double deadline = step_deadline(clock, start, dt);
+  int cycles = (int) ((deadline - start) * config->cycles_per_s);
+
+  struct motion motion;
+  motion_init(&motion, config, from, to, dt, cycles, lock);
+
+  volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
+  volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
+
+  uint32_t last_bits = 0;
+  uint32_t pin_mask = config_pin_mask(config);
+  uint64_t start_ticks = cycle_counter();
+  double ticks_per_cycle = config->pwm_config.engine == PWM_ENGINE_EDGE ? cycle_counter_hz() / config->cycles_per_s : 0;
+
+  struct frame_stats frame_stats = { 0 };
+  double frame_budget = config->pwm_config.length_pow2 / config->cycles_per_s;
+
+  for (int i = 0; i < cycles && !worker_abort; /* i is incremented by the k loop below */)
+  {
+    if (i % 1024 == 0)
+    {
+      atomic_thread_fence(memory_order_acquire);
+    }
+    double now = secs(); // unit s
+    if (i > 0)
+    {
+      frame_stats_add(&frame_stats, now - last_frame, frame_budget);
+    }
+    last_frame = now;
+    // the edge engine works frames out ahead of time, so go by when the frame is due
+    double t_global = config->pwm_config.engine == PWM_ENGINE_EDGE ? start + i / config->cycles_per_s : now;
+    struct frame frame;
+    motion_frame(&motion, config, i, t_global, &frame);
+
+    int pwm_len = min(config->pwm_config.length_pow2, cycles - i);
+    if (config->pwm_config.engine == PWM_ENGINE_EDGE)
+    {
+      step_edges(
+        &frame, pwm_len, pin_mask, i == 0, &last_bits,
+        start_ticks + i * ticks_per_cycle, ticks_per_cycle, set_reg, clr_reg
+      );
+      i += pwm_len;
+      continue;
+    }
+    if (i == 0)
+    {
+      // only changes are written from here on; drop whatever was left on before
+      gpio_write(set_reg, clr_reg, 0, pin_mask & ~frame_bits(&frame, 0));
+    }
+    struct frame_word *words = frame_words_buffer(&frame_word_buffer, &frame_word_capacity, pwm_len);
+    frame_words(&frame, 1, pwm_len, &last_bits, words);
+    for (int k = 0; k < pwm_len; k++)
+    {
+#ifdef LOG_SERVO_TIMINGS
+      if ((words[k].set | words[k].clr) & frame.bit_servo) dprintf(servolog, "%f\t%i\n", secs(), !!(words[k].set & frame.bit_servo));
+#endif
+
+      gpio_write(set_reg, clr_reg, words[k].set, words[k].clr);
+    }
+    i += pwm_len;
+  }
+  if (config->pwm_config.engine == PWM_ENGINE_EDGE && !worker_abort)
+  {
+    // let the last frame run its length before the next segment starts over at k = 0
+    wait_ticks(start_ticks + cycles * ticks_per_cycle);
+  }
+  double end = secs();
+  global_cycle_counter += cycles;
+  stats_segment(dt, end - start, &frame_stats, global_cycle_counter);
+  step_measure(config, clock, cycles, start, end);
+}
+
+// sleep on the queue until `deadline`, spinning out the last HOLD_SPIN s if it has to be `exact`
+static void hold_wait(struct task_ring_buffer *queue, double deadline, bool exact)
+{
+  double wake = exact ? deadline - HOLD_SPIN : deadline;
+  double now;
+  while ((now = secs()) < wake && !worker_abort)
+  {
+    // a task coming in wakes us early, but the frame still runs out
+    if (ringbuffer_wait(queue, wake - now)) break;
+  }
+  while (secs() < deadline) { }
+}
+
+void step_block(struct eggbot_config *config, struct step_clock *clock, struct step_progress *progress, const struct frame_block *block)
+{
+  volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
+  volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
+  int length = config->pwm_config.length_pow2;
+  double frame_budget = length / config->cycles_per_s;
+
+  if (block->first)
+  {
+    double now = secs();
+    *progress = (struct step_progress) { .start = now, .last_frame = now };
+    step_deadline(clock, now, block->dt);
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  const struct frame_word *words = block->words;
+  for (int i = 0; i < block->count && !worker_abort; i += length)
+  {
+    double now = secs();
+    if (i > 0 || !block->first)
+    {
+      frame_stats_add(&progress->frame_stats, now - progress->last_frame, frame_budget);
+    }
+    progress->last_frame = now;
+
+    int end = min(i + length, block->count);
+    for (int k = i; k < end; k++)
+    {
+#ifdef LOG_SERVO_TIMINGS
+      uint32_t bit_servo = config->dry_run ? 0 : 1u << config->servo_config.out;
+      if ((words[k].set | words[k].clr) & bit_servo) dprintf(servolog, "%f\t%i\n", secs(), !!(words[k].set & bit_servo));
+#endif
+
+      gpio_write(set_reg, clr_reg, words[k].set, words[k].clr);
+    }
+  }
+  global_cycle_counter += block->count;
+  if (!block->last) return;
+
+  double end = secs();
+  stats_segment(block->dt, end - progress->start, &progress->frame_stats, global_cycle_counter);
+  if (!progress->held) step_measure(config, clock, block->cycles, progress->start, end);
+}
+
+void hold(struct eggbot_config *config, coordinate at, struct task_ring_buffer *queue)
+{
+  volatile uint32_t *set_reg = gpio_port + (GPIO_SET_OFFSET / sizeof(uint32_t));
+  volatile uint32_t *clr_reg = gpio_port + (GPIO_CLR_OFFSET / sizeof(uint32_t));
+
+  int length = config->pwm_config.length_pow2;
+  double frame_s = length / config->cycles_per_s;
+  at.egg_speed = at.pen_speed = 0;
+  // every frame is the first of a one-frame move that goes nowhere
+  struct motion motion;
+  motion_init(&motion, config, at, at, frame_s, length, true);
+
+  uint32_t pin_mask = config_pin_mask(config);
+  uint32_t last_bits = 0, servo_bit = 1u << config->servo_config.out;
+  double frame_start = secs();
+  for (bool refresh = true; !worker_abort; refresh = false)
+  {
+    struct frame frame;
+    motion_frame(&motion, config, 0, frame_start, &frame);
+    struct edge edges[FRAME_MAX_EDGES];
+    uint32_t levels = last_bits;
+    int count = step_frame_edges(&frame, length, pin_mask, refresh, &last_bits, edges);
+    for (int e = 0; e < count; e++)
+    {
+      if (!(edges[e].set | edges[e].clr)) continue;
+
+      // waking up is late by a varying amount, so the servo pulse is spun through from its start
+      bool exact = ((edges[e].set | edges[e].clr | levels) & servo_bit) != 0;
+      hold_wait(queue, frame_start + edges[e].k / config->cycles_per_s, exact);
+      gpio_write_changes(set_reg, clr_reg, edges[e].set, edges[e].clr);
+      levels = (levels | edges[e].set) & ~edges[e].clr;
+    }
+
+    frame_start += frame_s;
+    // hand over between servo pulses, so none gets cut short
+    if (!(levels & servo_bit) && ringbuffer_peek(queue)) break;
+    if (secs() > frame_start + frame_s)
+    {
+      // overslept a whole frame; don't try to catch up
+      frame_start = secs();
+    }
+    hold_wait(queue, frame_start, levels & servo_bit);
+  }
+}
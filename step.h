@@ -0,0 +1,55 @@
+#ifndef RASPBERRYEGG_STEP_H
+#define RASPBERRYEGG_STEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "motion.h"
+#include "ringbuffer.h"
+#include "stats.h"
+#include "util.h"
+
+// stops step() at its next frame, and the workers of all machines with it
+extern bool worker_abort;
+
+// cycles run by step() so far, on this worker's thread
+extern _Thread_local uint64_t global_cycle_counter;
+
+#ifdef LOG_SERVO_TIMINGS
+extern int servolog;
+#endif
+
+// keeps consecutive segments on an absolute CLOCK_MONOTONIC schedule, so timing errors
+// don't add up over a print, and tracks the real loop rate as it drifts
+struct step_clock
+{
+  bool running; // false until the first segment, or after falling too far behind
+  double deadline; // secs() at which the last segment was due to end
+  double measured_cycles_per_s; // over the last segment
+  double lag; // s the last segment ended after its deadline
+  uint64_t reanchors; // times the schedule was given up on
+};
+
+// bit-bang the move from `from` to `to` over `dt` s into the gpio registers.
+// with `lock`, hold the position with 90° substeps at the lock factor.
+// with a `clock`, the move ends `dt` after the previous one was due to end rather than `dt` from now,
+// and config->cycles_per_s is corrected from the measured loop rate. without one, step() free-runs.
+void step(struct eggbot_config *config, struct step_clock *clock, coordinate from, coordinate to, float dt, bool lock);
+
+// a prepared move (-P) partway through being written out, kept across its blocks
+struct step_progress
+{
+  double start, last_frame;
+  bool held; // the worker held still partway through, so the move says nothing about the loop rate
+  struct frame_stats frame_stats;
+};
+
+// write out a block of prepared words, one per loop cycle. the move's first block starts it on
+// `clock`'s schedule, and its last one corrects config->cycles_per_s like step() does.
+void step_block(struct eggbot_config *config, struct step_clock *clock, struct step_progress *progress, const struct frame_block *block);
+
+// hold `at` with lock substeps until a task is queued. meant for a config with a low pwm rate: the
+// worker sleeps on `queue` between edges, only spinning right before servo edges to keep them sharp.
+void hold(struct eggbot_config *config, coordinate at, struct task_ring_buffer *queue);
+
+#endif
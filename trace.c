@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct trace *gpio_trace = NULL;
+
+void trace_start(size_t capacity)
+{
+  struct trace *trace = malloc(sizeof(struct trace));
+  *trace = (struct trace) {
+    .entries = malloc(sizeof(struct trace_entry) * capacity),
+    .capacity = capacity,
+  };
+  atomic_init(&trace->count, 0);
+  atomic_init(&trace->writes, 0);
+  atomic_init(&trace->dropped, 0);
+  if (!trace->entries)
+  {
+    fprintf(stderr, "can't allocate a trace of %zu entries\n", capacity);
+    abort();
+  }
+  gpio_trace = trace;
+}
+
+void trace_record(uint32_t set, uint32_t clr)
+{
+  struct trace *trace = gpio_trace;
+  atomic_fetch_add_explicit(&trace->writes, 1, memory_order_relaxed);
+  if (!(set | clr)) return;
+
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  size_t index = atomic_fetch_add_explicit(&trace->count, 1, memory_order_relaxed);
+  if (index >= trace->capacity)
+  {
+    atomic_fetch_add_explicit(&trace->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  trace->entries[index] = (struct trace_entry) {
+    .ns = time.tv_sec * 1000000000ull + time.tv_nsec,
+    .set = set,
+    .clr = clr,
+  };
+}
+
+// entries written, in time order. with several writers, an entry can land a little after one that
+// was timed later; it's nearly sorted, so an insertion sort, which also keeps each writer's own order
+size_t trace_finish()
+{
+  struct trace *trace = gpio_trace;
+  size_t count = atomic_load(&trace->count);
+  if (count > trace->capacity) count = trace->capacity;
+
+  struct trace_entry *entries = trace->entries;
+  for (size_t i = 1; i < count; i++)
+  {
+    struct trace_entry entry = entries[i];
+    size_t k = i;
+    for (; k > 0 && entries[k - 1].ns > entry.ns; k--)
+    {
+      entries[k] = entries[k - 1];
+    }
+    entries[k] = entry;
+  }
+  return count;
+}
+
+void trace_save(const char *filename)
+{
+  struct trace *trace = gpio_trace;
+  size_t count = trace_finish();
+  FILE *file = fopen(filename, "w");
+  if (!file || fwrite(trace->entries, sizeof(struct trace_entry), count, file) != count || fclose(file) != 0)
+  {
+    perror("can't save trace: ");
+    abort();
+  }
+}
+
+void trace_summary(FILE *file)
+{
+  struct trace *trace = gpio_trace;
+  size_t count = trace_finish();
+  if (count < 2)
+  {
+    fprintf(file, "trace: %zu changes, nothing to report\n", count);
+    return;
+  }
+  double span = (trace->entries[count - 1].ns - trace->entries[0].ns) / 1e9;
+  fprintf(file, "trace: %.3f s, %llu writes (%.0f/s), %zu changes, %llu dropped\n",
+    span, (unsigned long long) trace->writes, trace->writes / span, count, (unsigned long long) trace->dropped);
+}
+
+void trace_report(FILE *file, uint32_t pin_mask, int servo_pin)
+{
+  struct trace *trace = gpio_trace;
+  size_t count = trace_finish();
+
+  // the pins outside the mask belong to other machines; their writes don't change ours
+  size_t changes = 0;
+  uint64_t start = 0, end = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const struct trace_entry *entry = &trace->entries[i];
+    if (!((entry->set | entry->clr) & pin_mask)) continue;
+    if (!changes++) start = entry->ns;
+    end = entry->ns;
+  }
+  if (changes < 2 || end == start)
+  {
+    fprintf(file, "%zu changes, nothing to report\n", changes);
+    return;
+  }
+
+  uint64_t high_ns[32] = { 0 };
+  uint64_t rose[32] = { 0 };
+  uint32_t levels = 0;
+  uint64_t last = start;
+
+  uint32_t servo_bit = 1u << servo_pin;
+  uint64_t pulses = 0, pulse_min = UINT64_MAX, pulse_max = 0, pulse_total = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const struct trace_entry *entry = &trace->entries[i];
+    if (!((entry->set | entry->clr) & pin_mask)) continue;
+    for (int pin = 0; pin < 32; pin++)
+    {
+      if (levels & (1u << pin)) high_ns[pin] += entry->ns - last;
+    }
+    uint32_t next = ((levels & ~entry->clr) | entry->set) & pin_mask;
+    for (int pin = 0; pin < 32; pin++)
+    {
+      if ((next & ~levels) & (1u << pin)) rose[pin] = entry->ns;
+    }
+    // only count pulses we saw start
+    if ((levels & ~next & servo_bit) && rose[servo_pin])
+    {
+      uint64_t width = entry->ns - rose[servo_pin];
+      pulses++;
+      pulse_total += width;
+      if (width < pulse_min) pulse_min = width;
+      if (width > pulse_max) pulse_max = width;
+    }
+    levels = next;
+    last = entry->ns;
+  }
+
+  fprintf(file, "%zu changes over %.3f s\n", changes, (end - start) / 1e9);
+  for (int pin = 0; pin < 32; pin++)
+  {
+    if (!(pin_mask & (1u << pin))) continue;
+    fprintf(file, "  gpio %2i: %6.2f%% on\n", pin, 100.0 * high_ns[pin] / (end - start));
+  }
+  if (pulses)
+  {
+    fprintf(file, "  servo pulses: %llu, %.1f/%.1f/%.1f us min/mean/max\n",
+      (unsigned long long) pulses, pulse_min / 1e3, pulse_total / 1e3 / pulses, pulse_max / 1e3);
+  }
+}
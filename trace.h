@@ -0,0 +1,48 @@
+#ifndef RASPBERRYEGG_TRACE_H
+#define RASPBERRYEGG_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// a log of every gpio write that changed something, for checking timing off the pi.
+// saved as the raw entries array, little-endian. the workers of several machines can record at once;
+// their entries are put in time order before saving or reporting.
+
+struct trace_entry
+{
+  uint64_t ns; // CLOCK_MONOTONIC
+  uint32_t set, clr;
+};
+
+struct trace
+{
+  struct trace_entry *entries;
+  atomic_size_t count; // claimed entries; may run past capacity
+  size_t capacity;
+  atomic_uint_least64_t writes; // including the ones that didn't change anything
+  atomic_uint_least64_t dropped; // once the buffer was full
+};
+
+// NULL unless tracing
+extern struct trace *gpio_trace;
+
+void trace_start(size_t capacity);
+
+void trace_record(uint32_t set, uint32_t clr);
+
+// once writing has stopped: sorts the entries by time, returns how many there are
+size_t trace_finish();
+
+void trace_save(const char *filename);
+
+// achieved write rate over the whole trace, all machines together
+void trace_summary(FILE *file);
+
+// one machine's share of the trace: changes to the pins in `pin_mask`, their duty over the time
+// the machine was writing, servo pulse widths
+void trace_report(FILE *file, uint32_t pin_mask, int servo_pin);
+
+#endif
@@ -1,27 +1,6 @@
 #include "util.h"
 
-unit unit_rebalance(unit unit)
-{
-  while (unit.substep >= 1.0)
-  {
-    unit.step += 1;
-    unit.substep -= 1.0;
-  }
-  while (unit.substep < 0.0)
-  {
-    unit.step -= 1;
-    unit.substep += 1.0;
-  }
-  return unit;
-}
-
-unit unit_add(unit unit, float f)
-{
-  unit.substep += f;
-  return unit_rebalance(unit);
-}
-
-coordinate coord_advance(coordinate from, float egg, float pen, float servo)
+coordinate coord_advance(coordinate from, double egg, double pen, float servo)
 {
   return (coordinate) {
     .egg = unit_add(from.egg, egg),
@@ -30,15 +9,15 @@ coordinate coord_advance(coordinate from, float egg, float pen, float servo)
   };
 }
 
-float unitf(unit unit)
+double cycle_counter_hz()
 {
-  return (float) unit.step + unit.substep;
-}
-
-float unit_diff_f(unit from, unit to)
-{
-  to.step -= from.step;
-  to.substep -= from.substep;
-  to = unit_rebalance(to);
-  return (float) to.step + to.substep;
+  static double hz = 0;
+  if (hz == 0)
+  {
+    double start = secs();
+    uint64_t ticks = cycle_counter();
+    while (secs() - start < 0.05) { }
+    hz = (cycle_counter() - ticks) / (secs() - start);
+  }
+  return hz;
 }
@@ -1,16 +1,20 @@
 #ifndef RASPBERRYEGG_UTIL_H
 #define RASPBERRYEGG_UTIL_H
 
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 
+// a position in units as 32.32 fixed point: whole steps in the top half, the fraction of a step
+// below. sums and differences are exact, so a position doesn't drift over a job of a million moves
 typedef struct
 {
-  int step;
-  float substep;
+  int64_t fixed;
 } unit;
 
+#define UNIT_ONE ((int64_t) 1 << 32)
+
 typedef struct
 {
   unit egg;
@@ -20,15 +24,68 @@ typedef struct
   float servo;
 } coordinate;
 
-unit unit_rebalance(unit unit);
+// f * UNIT_ONE to the nearest integer, halves away from zero. llrint() would be a libm call;
+// this is a truncating convert and a few bit ops, no branches
+static inline int64_t unit_fixed(double f)
+{
+  double scaled = f * UNIT_ONE;
+  return (int64_t) (scaled + copysign(0.5, scaled));
+}
+
+// `f` units, to the nearest 2^-32
+static inline unit unit_from_f(double f)
+{
+  return (unit) { unit_fixed(f) };
+}
+
+static inline unit unit_steps(int steps)
+{
+  return (unit) { (int64_t) steps * UNIT_ONE };
+}
+
+static inline unit unit_add(unit u, double f)
+{
+  u.fixed += unit_fixed(f);
+  return u;
+}
+
+// whole units, rounded down
+static inline int unit_step(unit u)
+{
+  return (int) (u.fixed >> 32);
+}
+
+// the fraction of a unit past unit_step(), in [0, 1)
+static inline double unit_substep(unit u)
+{
+  return (uint32_t) u.fixed * 0x1p-32;
+}
+
+static inline double unitf(unit u)
+{
+  return u.fixed * 0x1p-32;
+}
 
-unit unit_add(unit unit, float f);
+static inline double unit_diff_f(unit from, unit to)
+{
+  return (to.fixed - from.fixed) * 0x1p-32;
+}
 
-coordinate coord_advance(coordinate from, float egg, float pen, float servo);
+// the substep as a winding phase, with 2^64 being one full step (see motion.h)
+static inline uint64_t unit_phase(unit u)
+{
+  return (uint64_t) u.fixed << 32;
+}
 
-float unitf(unit unit);
+// to the closest quarter unit, halves rounding up
+static inline unit unit_round_quarter(unit u)
+{
+  const int64_t quarter = UNIT_ONE / 4;
+  u.fixed = (u.fixed + quarter / 2) & ~(quarter - 1);
+  return u;
+}
 
-float unit_diff_f(unit from, unit to);
+coordinate coord_advance(coordinate from, double egg, double pen, float servo);
 
 static inline double secs()
 {
@@ -38,6 +95,31 @@ static inline double secs()
   return time.tv_sec * 1.0 + time.tv_nsec / 1000000000.0;
 }
 
+// a cheap free-running counter: the TSC on x86, the generic timer on arm, else CLOCK_MONOTONIC in ns
+static inline uint64_t cycle_counter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t low, high;
+  __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+  return ((uint64_t) high << 32) | low;
+#elif defined(__aarch64__)
+  uint64_t value;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (value));
+  return value;
+#elif defined(__arm__) && __ARM_ARCH >= 7
+  uint64_t value;
+  __asm__ __volatile__ ("mrrc p15, 1, %Q0, %R0, c14" : "=r" (value));
+  return value;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000ull + time.tv_nsec;
+#endif
+}
+
+// cycle_counter() ticks per s, measured against CLOCK_MONOTONIC on the first call
+double cycle_counter_hz();
+
 static inline int min(int a, int b)
 {
   return (a < b) ? a : b;
@@ -54,7 +136,14 @@ static inline uint32_t next_pow2(uint32_t i) {
 
 static inline void nap(int ms)
 {
-  struct timespec spec = { .tv_sec = 0, .tv_nsec = ms * 1000 * 1000 };
+  struct timespec spec = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000 * 1000 };
+  nanosleep(&spec, NULL);
+}
+
+static inline void nap_secs(double s)
+{
+  if (s <= 0) return;
+  struct timespec spec = { .tv_sec = (time_t) s, .tv_nsec = (long) ((s - (time_t) s) * 1e9) };
   nanosleep(&spec, NULL);
 }
 
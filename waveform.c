@@ -0,0 +1,221 @@
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pi.h"
+#include "waveform.h"
+
+struct waveform_writer *waveform_create(const char *filename, struct eggbot_config config)
+{
+  FILE *file = fopen(filename, "w");
+  if (!file)
+  {
+    perror("can't create waveform file: ");
+    abort();
+  }
+
+  struct waveform_writer *writer = malloc(sizeof(struct waveform_writer));
+  *writer = (struct waveform_writer) {
+    .file = file,
+    .config = config,
+    .header = {
+      .magic = WAVEFORM_MAGIC,
+      .version = WAVEFORM_VERSION,
+      .ticks_per_s = (uint32_t) config.cycles_per_s,
+      .ticks_per_pwm = config.pwm_config.length_pow2,
+      .pin_mask = config_pin_mask(&config),
+    },
+  };
+  // placeholder, rewritten with the final counts by waveform_finish()
+  if (fwrite(&writer->header, sizeof(writer->header), 1, file) != 1)
+  {
+    perror("can't write waveform header: ");
+    abort();
+  }
+  return writer;
+}
+
+static void waveform_flush(struct waveform_writer *writer)
+{
+  if (writer->pending.ticks == 0) return;
+
+  if (fwrite(&writer->pending, sizeof(writer->pending), 1, writer->file) != 1)
+  {
+    perror("can't write waveform record: ");
+    abort();
+  }
+  writer->header.record_count++;
+  writer->pending = (struct waveform_record) { 0 };
+}
+
+// extend the stream by one tick at gpio levels `bits`
+static void waveform_emit(struct waveform_writer *writer, uint32_t bits)
+{
+  if (bits != writer->last_bits || writer->pending.ticks == UINT32_MAX)
+  {
+    waveform_flush(writer);
+    writer->pending.set =  bits & ~writer->last_bits;
+    writer->pending.clr = ~bits &  writer->last_bits;
+    writer->last_bits = bits;
+  }
+  writer->pending.ticks++;
+  writer->header.total_ticks++;
+}
+
+void waveform_compile(struct waveform_writer *writer, coordinate from, coordinate to, float dt)
+{
+  if (dt < 0)
+  {
+    fprintf(stderr, "Time travel detected!\n");
+    abort();
+  }
+
+  struct eggbot_config *config = &writer->config;
+  struct motion motion;
+  motion_init(&motion, config, from, to, dt, (int) (dt * config->cycles_per_s), false);
+
+  for (int i = 0; i < motion.cycles; /* i is incremented by the k loop below */)
+  {
+    // the servo pwm runs off the stream's own clock, not the wall clock
+    double t_global = writer->header.total_ticks / config->cycles_per_s;
+    struct frame frame;
+    motion_frame(&motion, config, i, t_global, &frame);
+
+    int pwm_len = min(config->pwm_config.length_pow2, motion.cycles - i);
+    for (int k = 0; k < pwm_len; k++)
+    {
+      waveform_emit(writer, frame_bits(&frame, k));
+    }
+    i += pwm_len;
+  }
+}
+
+void waveform_finish(struct waveform_writer *writer, coordinate end)
+{
+  waveform_flush(writer);
+
+  writer->header.end_egg = end.egg.fixed;
+  writer->header.end_pen = end.pen.fixed;
+  writer->header.end_servo = end.servo;
+
+  if (fseek(writer->file, 0, SEEK_SET) != 0
+    || fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1
+    || fclose(writer->file) != 0)
+  {
+    perror("can't finish waveform file: ");
+    abort();
+  }
+  printf(
+    "compiled %llu records, %f s\n",
+    (unsigned long long) writer->header.record_count,
+    writer->header.total_ticks / (double) writer->header.ticks_per_s
+  );
+  free(writer);
+}
+
+bool waveform_probe(const char *filename)
+{
+  char magic[8];
+  FILE *file = fopen(filename, "r");
+  if (!file) return false;
+
+  bool res = fread(magic, sizeof(magic), 1, file) == 1
+    && memcmp(magic, WAVEFORM_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+  return res;
+}
+
+struct waveform *waveform_open(const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  struct stat stat;
+  if (fd < 0 || fstat(fd, &stat) != 0)
+  {
+    perror("can't open waveform file: ");
+    abort();
+  }
+
+  if ((size_t) stat.st_size < sizeof(struct waveform_header))
+  {
+    fprintf(stderr, "waveform file %s is truncated\n", filename);
+    abort();
+  }
+
+  void *map = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "mmap error %p\n", map);
+    abort();
+  }
+
+  const struct waveform_header *header = map;
+  if (memcmp(header->magic, WAVEFORM_MAGIC, sizeof(header->magic)) != 0 || header->version != WAVEFORM_VERSION)
+  {
+    fprintf(stderr, "%s is not a version %i waveform file\n", filename, WAVEFORM_VERSION);
+    abort();
+  }
+  if (stat.st_size != sizeof(struct waveform_header) + header->record_count * sizeof(struct waveform_record))
+  {
+    fprintf(stderr, "waveform file %s: size does not match record count\n", filename);
+    abort();
+  }
+
+  struct waveform *waveform = malloc(sizeof(struct waveform));
+  *waveform = (struct waveform) {
+    .header = header,
+    .records = (const struct waveform_record*) (header + 1),
+    .size = stat.st_size,
+  };
+  return waveform;
+}
+
+void waveform_close(struct waveform *waveform)
+{
+  munmap((void*) waveform->header, waveform->size);
+  free(waveform);
+}
+
+coordinate waveform_end(const struct waveform *waveform, coordinate start)
+{
+  const struct waveform_header *header = waveform->header;
+  return (coordinate) {
+    .egg = { start.egg.fixed + header->end_egg },
+    .pen = { start.pen.fixed + header->end_pen },
+    .servo = header->end_servo,
+  };
+}
+
+void waveform_replay(const struct waveform *waveform, volatile uint32_t *set_reg, volatile uint32_t *clr_reg, const bool *abort)
+{
+  const struct waveform_header *header = waveform->header;
+  double s_per_tick = 1.0 / header->ticks_per_s;
+  double start = secs();
+  uint64_t ticks = 0;
+
+  if (header->record_count > 0)
+  {
+    // the stream was compiled from all pins low and only writes changes; drop whatever hold()
+    // or the last move left on
+    gpio_write(set_reg, clr_reg, 0, header->pin_mask & ~waveform->records[0].set);
+  }
+  for (uint64_t i = 0; i < header->record_count; i++)
+  {
+    if (i % 1024 == 0)
+    {
+      atomic_thread_fence(memory_order_acquire);
+      if (*abort) break;
+    }
+    const struct waveform_record *record = &waveform->records[i];
+
+    gpio_write(set_reg, clr_reg, record->set, record->clr);
+
+    ticks += record->ticks;
+    double deadline = start + ticks * s_per_tick;
+    while (secs() < deadline);
+  }
+}
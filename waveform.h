@@ -0,0 +1,75 @@
+#ifndef RASPBERRYEGG_WAVEFORM_H
+#define RASPBERRYEGG_WAVEFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "motion.h"
+#include "util.h"
+
+// a compiled job: the gpio set/clr stream the live stepper loop would write, computed ahead of time.
+// all fields are little-endian, which is what both the pi and x86 are, so the file is mmapped as-is.
+
+#define WAVEFORM_MAGIC "EGGWAVE\0"
+#define WAVEFORM_VERSION 2
+
+struct waveform_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t ticks_per_s;   // time base of waveform_record.ticks
+  uint32_t ticks_per_pwm; // pwm frame length the job was compiled with
+  uint32_t pin_mask;      // every gpio the stream may drive
+  uint64_t record_count;
+  uint64_t total_ticks;
+  // where the job leaves the pen, relative to the origin it was compiled from
+  int64_t end_egg; // unit.fixed
+  int64_t end_pen;
+  float end_servo;
+  uint32_t reserved;
+};
+
+struct waveform_record
+{
+  uint32_t set;
+  uint32_t clr;
+  uint32_t ticks; // hold this state for so long before the next record
+};
+
+struct waveform_writer
+{
+  FILE *file;
+  struct eggbot_config config;
+  struct waveform_header header;
+  struct waveform_record pending; // the run currently being extended
+  uint32_t last_bits;
+};
+
+struct waveform
+{
+  const struct waveform_header *header;
+  const struct waveform_record *records;
+  size_t size; // of the mapping
+};
+
+// `config.cycles_per_s` is the tick rate of the stream, `config.pwm_config.length_pow2` the ticks per pwm frame
+struct waveform_writer *waveform_create(const char *filename, struct eggbot_config config);
+
+void waveform_compile(struct waveform_writer *writer, coordinate from, coordinate to, float dt);
+
+void waveform_finish(struct waveform_writer *writer, coordinate end);
+
+bool waveform_probe(const char *filename);
+
+struct waveform *waveform_open(const char *filename);
+
+void waveform_close(struct waveform *waveform);
+
+// where the job leaves the pen if it is started at `start`
+coordinate waveform_end(const struct waveform *waveform, coordinate start);
+
+// write the stream to the registers, keeping to its timing. returns early if `*abort` becomes set.
+void waveform_replay(const struct waveform *waveform, volatile uint32_t *set_reg, volatile uint32_t *clr_reg, const bool *abort);
+
+#endif
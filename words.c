@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#include "words.h"
+
+void frame_words_scalar(const struct frame *frames, int count, int length, uint32_t *last_bits, struct frame_word *words)
+{
+  uint32_t last = *last_bits;
+  for (int f = 0; f < count; f++)
+  {
+    for (int k = 0; k < length; k++)
+    {
+      uint32_t bits = frame_bits(&frames[f], k);
+      *words++ = (struct frame_word) { .set = bits & ~last, .clr = ~bits & last };
+      last = bits;
+    }
+  }
+  *last_bits = last;
+}
+
+// cycles from `k` on, one at a time; the tail that doesn't fill a vector
+static uint32_t frame_words_tail(const struct frame *frame, int k, int length, uint32_t last, struct frame_word *words)
+{
+  for (; k < length; k++)
+  {
+    uint32_t bits = frame_bits(frame, k);
+    words[k] = (struct frame_word) { .set = bits & ~last, .clr = ~bits & last };
+    last = bits;
+  }
+  return last;
+}
+
+#ifdef __SSE2__
+
+// frame_bits() for cycles k..k+3: each winding's bits while k < its limit, the servo's while
+// k < servo_to_low or k >= servo_to_high. then each cycle's levels against the one before it
+static uint32_t frame_words_one(const struct frame *frame, int length, uint32_t last, struct frame_word *words)
+{
+  const __m128i limit_egg1 = _mm_set1_epi32(frame->pwm_limit_egg_winding1);
+  const __m128i limit_egg2 = _mm_set1_epi32(frame->pwm_limit_egg_winding2);
+  const __m128i limit_pen1 = _mm_set1_epi32(frame->pwm_limit_pen_winding1);
+  const __m128i limit_pen2 = _mm_set1_epi32(frame->pwm_limit_pen_winding2);
+  const __m128i bits_egg1 = _mm_set1_epi32(frame->bits_egg_winding1);
+  const __m128i bits_egg2 = _mm_set1_epi32(frame->bits_egg_winding2);
+  const __m128i bits_pen1 = _mm_set1_epi32(frame->bits_pen_winding1);
+  const __m128i bits_pen2 = _mm_set1_epi32(frame->bits_pen_winding2);
+  const __m128i servo_low = _mm_set1_epi32(frame->servo_to_low);
+  const __m128i servo_high = _mm_set1_epi32(frame->servo_to_high);
+  const __m128i bit_servo = _mm_set1_epi32(frame->bit_servo);
+  const __m128i four = _mm_set1_epi32(4);
+
+  __m128i k = _mm_setr_epi32(0, 1, 2, 3);
+  int i = 0;
+  for (; i + 4 <= length; i += 4)
+  {
+    __m128i bits = _mm_or_si128(
+      _mm_or_si128(
+        _mm_and_si128(_mm_cmplt_epi32(k, limit_egg1), bits_egg1),
+        _mm_and_si128(_mm_cmplt_epi32(k, limit_egg2), bits_egg2)
+      ),
+      _mm_or_si128(
+        _mm_and_si128(_mm_cmplt_epi32(k, limit_pen1), bits_pen1),
+        _mm_and_si128(_mm_cmplt_epi32(k, limit_pen2), bits_pen2)
+      )
+    );
+    bits = _mm_or_si128(bits, _mm_and_si128(_mm_cmplt_epi32(k, servo_low), bit_servo));
+    bits = _mm_or_si128(bits, _mm_andnot_si128(_mm_cmplt_epi32(k, servo_high), bit_servo));
+
+    // the levels one cycle earlier: shifted up a lane, the last vector's top lane coming in at the bottom
+    __m128i before = _mm_or_si128(_mm_slli_si128(bits, 4), _mm_cvtsi32_si128((int) last));
+    __m128i set = _mm_andnot_si128(before, bits);
+    __m128i clr = _mm_andnot_si128(bits, before);
+    _mm_storeu_si128((__m128i*) &words[i], _mm_unpacklo_epi32(set, clr));
+    _mm_storeu_si128((__m128i*) &words[i + 2], _mm_unpackhi_epi32(set, clr));
+
+    last = (uint32_t) _mm_cvtsi128_si32(_mm_shuffle_epi32(bits, 0xff));
+    k = _mm_add_epi32(k, four);
+  }
+  return frame_words_tail(frame, i, length, last, words);
+}
+
+#else
+
+// elsewhere, the pi included, one cycle at a time
+static uint32_t frame_words_one(const struct frame *frame, int length, uint32_t last, struct frame_word *words)
+{
+  return frame_words_tail(frame, 0, length, last, words);
+}
+
+#endif
+
+void frame_words(const struct frame *frames, int count, int length, uint32_t *last_bits, struct frame_word *words)
+{
+  uint32_t last = *last_bits;
+  for (int f = 0; f < count; f++)
+  {
+    last = frame_words_one(&frames[f], length, last, words + (size_t) f * length);
+  }
+  *last_bits = last;
+}
+
+struct frame_word *frame_words_buffer(struct frame_word **buffer, int *capacity, int length)
+{
+  if (length <= *capacity) return *buffer;
+
+  free(*buffer);
+  size_t size = (sizeof(struct frame_word) * length + WORDS_ALIGN - 1) / WORDS_ALIGN * WORDS_ALIGN;
+  *buffer = aligned_alloc(WORDS_ALIGN, size);
+  if (!*buffer)
+  {
+    fprintf(stderr, "can't allocate %i frame words\n", length);
+    abort();
+  }
+  *capacity = length;
+  return *buffer;
+}
@@ -0,0 +1,30 @@
+#ifndef RASPBERRYEGG_WORDS_H
+#define RASPBERRYEGG_WORDS_H
+
+#include <stdint.h>
+
+#include "motion.h"
+
+// the loop engine's register writes worked out ahead: for every cycle of a frame, the set/clr pair
+// that takes the pins from the last cycle's levels to frame_bits() at this one. the worker then
+// only streams them out. computed with sse2 four cycles at a time where there is sse2.
+
+#define WORDS_ALIGN 64
+
+struct frame_word
+{
+  uint32_t set, clr;
+};
+
+// the words for `count` frames of `length` cycles each, one after the other, starting from the levels
+// in `*last_bits`, which are left at the last cycle's. `words` holds count * length entries and
+// should be WORDS_ALIGN aligned.
+void frame_words(const struct frame *frames, int count, int length, uint32_t *last_bits, struct frame_word *words);
+
+// the same, one cycle at a time through frame_bits(); what frame_words() must match bit for bit
+void frame_words_scalar(const struct frame *frames, int count, int length, uint32_t *last_bits, struct frame_word *words);
+
+// a WORDS_ALIGN aligned buffer for at least `length` words, grown as needed
+struct frame_word *frame_words_buffer(struct frame_word **buffer, int *capacity, int length);
+
+#endif